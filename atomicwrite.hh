@@ -0,0 +1,175 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ATOMIC_WRITE_HH
+#define ATOMIC_WRITE_HH
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+#include <ios>
+#include <mutex>
+#include <set>
+#include <string_view>
+#include <utility>
+
+// Flushes a file or directory to storage. Syncing a directory makes the
+// names of the files in it durable. This needs POSIX; elsewhere, it does
+// nothing.
+[[nodiscard]] inline auto syncPath(
+        boost::filesystem::path const& name) noexcept -> bool {
+#ifndef _WIN32
+    int const fd = ::open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool const synced = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && synced;
+#else
+    static_cast<void>(name);
+    return true;
+#endif
+}
+
+// Writes data to target without ever leaving a partly written target behind:
+// the data goes to a temporary file in the same directory, which is renamed
+// over target once it is complete. An existing target keeps its permissions.
+// If syncData is true, the data is flushed to storage before the rename, so
+// that target cannot end up empty after a crash. Returns false, leaving target
+// untouched, if anything fails.
+[[nodiscard]] inline auto writeFileAtomic(
+        boost::filesystem::path const& target, std::string_view const data,
+        bool const syncData = false) -> bool {
+    boost::system::error_code     err;
+    boost::filesystem::path const temp
+            = target.parent_path()
+              / boost::filesystem::unique_path(
+                      "." + target.filename().string() + ".%%%%-%%%%.tmp",
+                      err);
+    if (err) {
+        return false;
+    }
+    boost::filesystem::file_status const status
+            = boost::filesystem::status(target, err);
+    {
+        boost::filesystem::ofstream fout(
+                temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        fout.write(data.data(), static_cast<std::streamsize>(data.size()));
+        fout.close();
+        if (!fout.good() || (syncData && !syncPath(temp))) {
+            boost::filesystem::remove(temp, err);
+            return false;
+        }
+    }
+    if (boost::filesystem::exists(status)) {
+        boost::filesystem::permissions(temp, status.permissions(), err);
+    }
+    boost::filesystem::rename(temp, target, err);
+    if (err) {
+        boost::filesystem::remove(temp, err);
+        return false;
+    }
+    return true;
+}
+
+enum SyncMode {
+    eSYNC_NONE,     // Nothing is synced; files are still replaced atomically
+    eSYNC_EACH,     // Each file and its directory are synced as it is written
+    eSYNC_BATCH    // Each file is synced, directories only by `finish()`
+};
+
+// Writes files atomically under a root directory, syncing them as the mode
+// asks. Syncing a directory after each file costs a metadata round trip per
+// file, which dominates on network storage; in batch mode, every directory is
+// synced once at the end instead. Either way, `finish()` syncs the directories
+// between the files and the root, as they may have been created on the way.
+// Can be used from many threads at once.
+class Atomic_writer {
+public:
+    Atomic_writer(SyncMode const _mode, boost::filesystem::path const& _root)
+            : mode(_mode), root(normalDirectory(_root)) {}
+
+    [[nodiscard]] auto write(
+            boost::filesystem::path const& target, std::string_view const data)
+            -> bool {
+        if (!writeFileAtomic(target, data, mode != eSYNC_NONE)) {
+            return false;
+        }
+        if (mode == eSYNC_NONE) {
+            return true;
+        }
+        boost::filesystem::path dir = normalDirectory(target.parent_path());
+        if (mode == eSYNC_EACH) {
+            if (!syncPath(dir)) {
+                return false;
+            }
+            if (dir == root) {
+                return true;
+            }
+            dir = normalDirectory(dir.parent_path());
+        }
+        std::lock_guard<std::mutex> lock(dirMutex);
+        // Ancestors of a directory already in the set are in it too.
+        for (; pendingDirs.insert(dir).second;
+             dir = normalDirectory(dir.parent_path())) {
+            if (dir == root) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    // Syncs the directories still pending. Returns false if any failed.
+    [[nodiscard]] auto finish() -> bool {
+        std::lock_guard<std::mutex> lock(dirMutex);
+        bool                        synced = true;
+        for (auto const& dir : pendingDirs) {
+            synced = syncPath(dir) && synced;
+        }
+        pendingDirs.clear();
+        return synced;
+    }
+
+private:
+    // Paths to the same directory, however they were written, compare equal
+    // once normalized: the walk up from a file to the root relies on it. The
+    // current directory is ".", never empty, so that it can be synced too.
+    [[nodiscard]] static auto normalDirectory(
+            boost::filesystem::path const& dir) -> boost::filesystem::path {
+        boost::filesystem::path result = dir.lexically_normal();
+        if (result.filename() == ".") {
+            result.remove_filename();
+        }
+        result.remove_trailing_separator();
+        if (result.empty()) {
+            result = ".";
+        }
+        return result;
+    }
+
+    SyncMode                          mode;
+    boost::filesystem::path           root;
+    std::mutex                        dirMutex;
+    std::set<boost::filesystem::path> pendingDirs;
+};
+
+#endif
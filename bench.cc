@@ -0,0 +1,376 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jsont.hh"
+#include "prettyJson.hh"
+#include "stitchJson.hh"
+#include "synthobb.hh"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::array;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ostream;
+using std::setw;
+using std::string;
+using std::string_view;
+using std::vector;
+
+using namespace std::literals::string_literals;
+using namespace std::literals::string_view_literals;
+
+using boost::filesystem::path;
+using boost::iostreams::filtering_ostream;
+using boost::iostreams::null_sink;
+
+// Every allocation made through operator new is counted, so that benchmarks
+// can report how many allocations each iteration makes. The replacements are
+// kept out of line, as GCC otherwise warns about free being called on memory
+// from operator new once they are inlined.
+static std::atomic<size_t> allocationCount{0};
+static std::atomic<size_t> allocatedBytes{0};
+
+__attribute__((noinline)) auto operator new(size_t size) -> void* {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size != 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) auto operator new[](size_t size) -> void* {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Keeps the compiler from optimizing away a computation whose result is
+// otherwise unused.
+template <typename T>
+__attribute__((always_inline)) inline void doNotOptimize(T const& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+enum ErrorCodes { eOK, eWRONG_ARGC, eINVALID_ARGS, eBENCH_FAILED };
+
+// Runs each benchmark repeatedly for a minimum amount of time, then reports
+// throughput over the given number of bytes, and allocations per iteration.
+// Allocations made by other processes cannot be counted, so they are only
+// reported for benchmarks that run in this one.
+class Bench_runner {
+public:
+    explicit Bench_runner(double _minSeconds) noexcept
+            : minSeconds(_minSeconds) {}
+
+    static void printHeader() {
+        cout << std::left << setw(36) << "Benchmark"sv << std::right
+             << setw(12) << "MB/s"sv << setw(14) << "allocs/iter"sv
+             << setw(14) << "KiB/iter"sv << endl;
+    }
+
+    template <typename Func>
+    void run(
+            string_view const name, size_t const bytes, Func&& func,
+            bool const inProcess = true) {
+        using clock = std::chrono::steady_clock;
+        // Warm up caches and lazily initialized state.
+        func();
+        size_t const count0     = allocationCount.load();
+        size_t const bytes0     = allocatedBytes.load();
+        size_t       iterations = 0;
+        auto const   start      = clock::now();
+        std::chrono::duration<double> elapsed{};
+        do {
+            func();
+            iterations++;
+            elapsed = clock::now() - start;
+        } while (iterations < 3 || elapsed.count() < minSeconds);
+        size_t const count = allocationCount.load() - count0;
+        size_t const total = allocatedBytes.load() - bytes0;
+
+        double const throughput = static_cast<double>(bytes)
+                                  * static_cast<double>(iterations)
+                                  / elapsed.count() / 1.0e6;
+        cout << std::left << setw(36) << name << std::right << std::fixed
+             << std::setprecision(1) << setw(12) << throughput;
+        if (inProcess) {
+            cout << setw(14) << count / iterations << setw(14)
+                 << total / iterations / 1024 << endl;
+        } else {
+            cout << setw(14) << "-"sv << setw(14) << "-"sv << endl;
+        }
+    }
+
+private:
+    double minSeconds;
+};
+
+void benchTokenizer(
+        Bench_runner& runner, string_view const name, string_view const json) {
+    runner.run("tokenizer/"s + string(name), json.size(), [json]() {
+        jsont::Tokenizer reader(json);
+        size_t           count = 0;
+        for (jsont::Token tok = reader.current();
+             tok != jsont::End && tok != jsont::Error; tok = reader.next()) {
+            count++;
+        }
+        doNotOptimize(count);
+    });
+}
+
+void benchPrintJSON(
+        Bench_runner& runner, string_view const name, string_view const json,
+        PrettyJSON const pretty) {
+    constexpr static const array<string_view, 3> modeNames{
+            "minify"sv, "pretty"sv, "compact"sv};
+    auto const   mode     = static_cast<size_t>(pretty + 1);
+    string const fullName = "printJSON/"s + string(modeNames[mode]) + "/"
+                            + string(name);
+    runner.run(fullName, json.size(), [json, pretty]() {
+        vector<char> output;
+        output.reserve(json.size() * 3 / 2);
+        Json_buffer sint(output);
+        printJSON(json, sint, pretty);
+        doNotOptimize(output);
+    });
+}
+
+void benchStitchFilter(Bench_runner& runner, Story_corpus const& story) {
+    size_t const bytes = story.mainJson.size() + story.inkContent.size();
+    runner.run("stitch filter/reference"sv, bytes, [&story]() {
+        filtering_ostream fsout;
+        fsout.push(json_stitch_filter(story.inkContent));
+        fsout.push(null_sink());
+        fsout << story.mainJson;
+        fsout.reset();
+    });
+    for (unsigned const jobs : {1U, 0U}) {
+        string const fullName = "stitch filter/pretty/"s
+                                + (jobs == 1 ? "1 thread"s : "all threads"s);
+        runner.run(fullName, bytes, [&story, jobs]() {
+            vector<char> output;
+            bool const valid = Stitch_expander(story.inkContent, ePRETTY, jobs)
+                                       .expand(story.mainJson, output);
+            doNotOptimize(valid);
+            doNotOptimize(output);
+        });
+    }
+}
+
+[[nodiscard]] auto runTool(string const& command) -> bool {
+    return std::system((command + " > /dev/null").c_str()) == 0;
+}
+
+// Edits one JSON file of an extracted OBB, and touches all the others, as a
+// checkout would: no file can then be reused by its stamp alone.
+void editExtractedFiles(path const& outdir) {
+    std::time_t const now    = std::time(nullptr);
+    bool              edited = false;
+    for (auto const& entry :
+         boost::filesystem::recursive_directory_iterator(outdir)) {
+        path const& file = entry.path();
+        if (!is_regular_file(file)) {
+            continue;
+        }
+        if (!edited && file.extension() == ".json"s
+            && file.parent_path().filename() == "text"s) {
+            boost::filesystem::ofstream(file, std::ios::out | std::ios::binary)
+                    << "[0]\n"sv;
+            edited = true;
+        } else {
+            last_write_time(file, now);
+        }
+    }
+}
+
+[[nodiscard]] auto benchEndToEnd(
+        Bench_runner& runner, path const& bindir,
+        Synthetic_obb_options const& options) -> bool {
+    path const xtractobb = bindir / "xtractobb";
+    path const repackobb = bindir / "repackobb";
+    if (!exists(xtractobb) || !exists(repackobb)) {
+        cerr << "Could not find xtractobb and repackobb in "sv << bindir
+             << "; skipping end-to-end benchmarks."sv << endl;
+        return true;
+    }
+
+    path const workdir = boost::filesystem::temp_directory_path()
+                         / boost::filesystem::unique_path();
+    create_directories(workdir);
+    path const obbfile  = workdir / "bench.obb";
+    path const outdir   = workdir / "extracted";
+    path const repacked = workdir / "repacked.obb";
+    size_t const bytes = writeSyntheticObb(obbfile, options);
+
+    string const extract
+            = xtractobb.string() + " -j 1 " + obbfile.string() + " "
+              + outdir.string();
+    string const repack
+            = repackobb.string() + " -j 1 " + outdir.string() + " "
+              + repacked.string();
+    string const repackBase
+            = repackobb.string() + " -j 1 -b " + obbfile.string() + " "
+              + outdir.string() + " " + repacked.string();
+    bool ok = runTool(extract);
+    if (ok) {
+        runner.run(
+                "end-to-end/extract"sv, bytes,
+                [&extract, &ok]() { ok = runTool(extract) && ok; }, false);
+    }
+    if (ok) {
+        runner.run(
+                "end-to-end/repack"sv, bytes,
+                [&repack, &ok]() { ok = runTool(repack) && ok; }, false);
+    }
+    if (ok) {
+        // Unchanged files are compared with the original OBB, and copied
+        // from it.
+        editExtractedFiles(outdir);
+        runner.run(
+                "end-to-end/repack -b, 1 edit"sv, bytes,
+                [&repackBase, &ok]() { ok = runTool(repackBase) && ok; },
+                false);
+    }
+    remove_all(workdir);
+    if (!ok) {
+        cerr << "End-to-end benchmark failed!"sv << endl;
+    }
+    return ok;
+}
+
+void usage(ostream& out, string_view const program) {
+    out << "Usage: "sv << program
+        << " [-t seconds] [-s stitches] [bindir]\n\n"sv
+        << "Where:\n"
+           "\t-t\tMinimum time to run each benchmark for. Defaults to 0.5.\n"
+           "\t-s\tNumber of stitches in the synthetic story. Defaults to "
+           "20000.\n"
+           "\tbindir\tDirectory with xtractobb and repackobb, for the "
+           "end-to-end\n"
+           "\t\tbenchmarks. Defaults to the current directory.\n\n"sv;
+}
+
+extern "C" auto main(int argc, char* argv[]) -> int;
+
+auto main(int argc, char* argv[]) -> int {
+    string_view const program(argv[0]);
+    double            minSeconds  = 0.5;
+    unsigned long     numStitches = 20000;
+    int               argi        = 1;
+    for (; argi < argc; argi++) {
+        string_view const arg(argv[argi]);
+        if (arg != "-t"sv && arg != "-s"sv) {
+            break;
+        }
+        if (++argi == argc) {
+            usage(cerr, program);
+            return eINVALID_ARGS;
+        }
+        char* end = nullptr;
+        if (arg == "-t"sv) {
+            minSeconds = std::strtod(argv[argi], &end);
+        } else {
+            numStitches = std::strtoul(argv[argi], &end, 10);
+        }
+        if (end == argv[argi] || *end != '\0') {
+            cerr << "Option '"sv << arg << "' requires a numeric argument!"sv
+                 << endl
+                 << endl;
+            usage(cerr, program);
+            return eINVALID_ARGS;
+        }
+    }
+    if (argc - argi > 1) {
+        usage(cerr, program);
+        return eWRONG_ARGC;
+    }
+    path const bindir(argi < argc ? argv[argi] : ".");
+
+    try {
+        Synthetic_obb_options options;
+        options.numStitches = static_cast<unsigned>(numStitches);
+        Corpus_generator   gen(options.seed);
+        Story_corpus const story = makeStoryCorpus(
+                gen, "Sorcery1.inkcontent"sv, options.numStitches);
+        vector<char> prettyJson;
+        {
+            filtering_ostream fsout;
+            fsout.push(json_filter(ePRETTY));
+            fsout.push(boost::iostreams::back_inserter(prettyJson));
+            fsout << story.mainJson;
+        }
+        string_view const pretty(prettyJson.data(), prettyJson.size());
+
+        cout << "Main JSON: "sv << story.mainJson.size()
+             << " bytes minified, "sv << pretty.size()
+             << " bytes pretty-printed; inkcontent: "sv
+             << story.inkContent.size() << " bytes."sv << endl
+             << endl;
+
+        Bench_runner runner(minSeconds);
+        Bench_runner::printHeader();
+        benchTokenizer(runner, "minified"sv, story.mainJson);
+        benchTokenizer(runner, "pretty"sv, pretty);
+        benchTokenizer(runner, "inkcontent"sv, story.inkContent);
+        for (PrettyJSON const mode : {ePRETTY, eCOMPACT, eNO_WHITESPACE}) {
+            benchPrintJSON(runner, "minified"sv, story.mainJson, mode);
+        }
+        benchPrintJSON(runner, "pretty"sv, pretty, eNO_WHITESPACE);
+        benchPrintJSON(runner, "inkcontent"sv, story.inkContent, ePRETTY);
+        benchStitchFilter(runner, story);
+        if (!benchEndToEnd(runner, bindir, options)) {
+            return eBENCH_FAILED;
+        }
+    } catch (std::exception const& except) {
+        cerr << except.what() << endl;
+        return eBENCH_FAILED;
+    }
+    return eOK;
+}
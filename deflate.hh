@@ -0,0 +1,100 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEFLATE_HH
+#define DEFLATE_HH
+
+#include <zlib.h>
+
+#include <array>
+#include <string_view>
+#include <vector>
+
+// How hard to try to make compressed files small.
+enum Compression {
+    eCOMPRESS_FAST,          // zlib level 1
+    eCOMPRESS_DEFAULT,       // zlib's default level, 6
+    eCOMPRESS_BEST,          // zlib level 9
+    eCOMPRESS_EXHAUSTIVE    // Level 9 with every zlib strategy, keeping the
+                            // smallest result
+};
+
+// Compresses source into a zlib stream in buffer, in a single call to zlib.
+// The buffer is sized up front to the worst case for the input, so the output
+// is never copied while it grows; it is then shrunk to the number of bytes
+// zlib reports having written. Returns false if zlib fails.
+[[nodiscard]] inline auto deflateInto(
+        std::string_view const source, std::vector<char>& buffer,
+        int const level = Z_BEST_COMPRESSION, int const memLevel = 8,
+        int const strategy = Z_DEFAULT_STRATEGY) -> bool {
+    z_stream strm{};
+    if (deflateInit2(&strm, level, Z_DEFLATED, MAX_WBITS, memLevel, strategy)
+        != Z_OK) {
+        return false;
+    }
+    buffer.resize(deflateBound(&strm, source.size()));
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    strm.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(source.data()));
+    strm.avail_in  = static_cast<uInt>(source.size());
+    strm.next_out  = reinterpret_cast<Bytef*>(buffer.data());
+    strm.avail_out = static_cast<uInt>(buffer.size());
+    int const result = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    buffer.resize(strm.total_out);
+    return result == Z_STREAM_END;
+}
+
+// Compresses source into buffer as mode asks. In exhaustive mode, every
+// setting is tried in turn, and ties go to the earlier one; as the first is
+// the same as eCOMPRESS_BEST, the result is never larger than it is.
+[[nodiscard]] inline auto deflateInto(
+        std::string_view const source, std::vector<char>& buffer,
+        Compression const mode) -> bool {
+    switch (mode) {
+    case eCOMPRESS_FAST:
+        return deflateInto(source, buffer, Z_BEST_SPEED);
+    case eCOMPRESS_DEFAULT:
+        return deflateInto(source, buffer, Z_DEFAULT_COMPRESSION);
+    case eCOMPRESS_BEST:
+        return deflateInto(source, buffer, Z_BEST_COMPRESSION);
+    case eCOMPRESS_EXHAUSTIVE:
+        break;
+    }
+    struct Setting {
+        int memLevel;
+        int strategy;
+    };
+    constexpr static const std::array<Setting, 6> settings{
+            Setting{8, Z_DEFAULT_STRATEGY}, Setting{9, Z_DEFAULT_STRATEGY},
+            Setting{8, Z_FILTERED},         Setting{9, Z_FILTERED},
+            Setting{9, Z_RLE},              Setting{9, Z_HUFFMAN_ONLY}};
+    std::vector<char> scratch;
+    bool              found = false;
+    for (auto const& [memLevel, strategy] : settings) {
+        if (!deflateInto(
+                    source, scratch, Z_BEST_COMPRESSION, memLevel, strategy)) {
+            return false;
+        }
+        if (!found || scratch.size() < buffer.size()) {
+            buffer.swap(scratch);
+            found = true;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -283,4 +283,41 @@ inline void Write4(std::ostream& out, uint32_t val) {
     out.write(std::cbegin(buffer), sizeof(uint32_t));
 }
 
+template <typename T, detail::is_pointer_like_t<T> = true>
+__attribute__((always_inline)) inline auto Read8(T&& in) -> uint64_t {
+    auto ptr{to_address(in)};
+    alignas(alignof(uint64_t)) std::array<uint8_t, sizeof(uint64_t)> buffer{};
+    std::memcpy(buffer.data(), ptr, sizeof(uint64_t));
+    uint64_t val = 0;
+    std::memcpy(&val, buffer.data(), sizeof(uint64_t));
+    std::advance(in, sizeof(uint64_t));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return val;
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(val);
+#else
+#    error "Byte order is neither little endian nor big endian. Do not know how to proceed."
+    return val;
+#endif
+}
+
+template <typename T, detail::is_pointer_like_t<T> = true>
+inline void Write8(T&& out, uint64_t val) {
+    auto ptr{to_address(out)};
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#elif __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#    error "Byte order is neither little endian nor big endian. Do not know how to proceed."
+#endif
+    std::memcpy(ptr, &val, sizeof(uint64_t));
+    std::advance(out, sizeof(uint64_t));
+}
+
+inline void Write8(std::ostream& out, uint64_t val) {
+    using oschar_t = std::ostream::char_type;
+    alignas(alignof(uint64_t)) std::array<oschar_t, sizeof(uint64_t)> buffer{};
+    Write8(std::begin(buffer), val);
+    out.write(std::cbegin(buffer), sizeof(uint64_t));
+}
+
 #endif
@@ -35,6 +35,7 @@ template <typename FileDataT>
 struct Basic_File_entry {
     std::string fname;
     FileDataT   fdata;
+    uint32_t    fulllength = 0U;    // Uncompressed size from the file table
     bool        compressed = false;
 
     static constexpr const size_t EntrySize = 20;
@@ -51,7 +52,8 @@ struct Basic_File_entry {
             std::string_view                 oggview) noexcept {
         fname      = getData(it, oggview);
         fdata      = getData(it, oggview);
-        compressed = fdata.size() != Read4(it);
+        fulllength = Read4(it);
+        compressed = fdata.size() != fulllength;
     }
 
 private:
@@ -0,0 +1,166 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "synthobb.hh"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ostream;
+using std::string_view;
+
+using namespace std::literals::string_view_literals;
+
+using boost::filesystem::path;
+
+enum ErrorCodes {
+    eOK,
+    eWRONG_ARGC,
+    eINVALID_ARGS,
+    eOBB_NO_ACCESS,
+    eOBB_TOO_LARGE
+};
+
+void usage(ostream& out, string_view const program) {
+    out << "Usage: "sv << program
+        << " [-n files] [-s stitches] [-m minsize] [-M maxsize] [-c percent]\n"
+           "\t[-p part] [-l level] [-r seed] outputfile\n\n"
+           "Writes a synthetic OBB file, for testing and benchmarking.\n\n"
+           "Where:\n"
+           "\t-n\tNumber of files besides the story files. Defaults to 64.\n"
+           "\t-s\tNumber of stitches in the story files; 0 leaves them out.\n"
+           "\t\tDefaults to 20000.\n"
+           "\t-m, -M\tMinimum and maximum size of the files besides the "
+           "story\n"
+           "\t\tfiles. Small files are more common than big ones. Default "
+           "to\n"
+           "\t\t1024 and 262144.\n"
+           "\t-c\tPercentage of the files besides the story files that are\n"
+           "\t\tcompressed JSON files; the others are incompressible binary\n"
+           "\t\tfiles. Defaults to 50.\n"
+           "\t-p\tPart number N of the SorceryN.json and "
+           "SorceryN.inkcontent\n"
+           "\t\tstory files. Defaults to 1.\n"
+           "\t-l\tzlib compression level, from 0 to 9. Defaults to 9.\n"
+           "\t-r\tSeed for the generator. The same seed and options always "
+           "give\n"
+           "\t\tthe same OBB.\n\n"sv;
+}
+
+// Parses a numeric option into value, which must be at most maximum.
+template <typename T>
+[[nodiscard]] auto parseNumber(
+        char const* arg, T& value, unsigned long long const maximum) -> bool {
+    char*                    end    = nullptr;
+    unsigned long long const result = std::strtoull(arg, &end, 0);
+    if (end == arg || *end != '\0' || *arg == '-' || result > maximum) {
+        return false;
+    }
+    value = static_cast<T>(result);
+    return true;
+}
+
+extern "C" auto main(int argc, char* argv[]) -> int;
+
+auto main(int argc, char* argv[]) -> int {
+    string_view const     program(argv[0]);
+    Synthetic_obb_options options;
+    int                   argi = 1;
+    for (; argi < argc; argi++) {
+        string_view const arg(argv[argi]);
+        if (arg.size() != 2 || arg[0] != '-') {
+            break;
+        }
+        if (++argi == argc) {
+            usage(cerr, program);
+            return eINVALID_ARGS;
+        }
+        char const* value  = argv[argi];
+        bool        parsed = false;
+        switch (arg[1]) {
+        case 'n':
+            parsed = parseNumber(value, options.numFiles, 1000000U);
+            break;
+        case 's':
+            parsed = parseNumber(value, options.numStitches, 100000000U);
+            break;
+        case 'm':
+            parsed = parseNumber(value, options.minSize, UINT32_MAX);
+            break;
+        case 'M':
+            parsed = parseNumber(value, options.maxSize, UINT32_MAX);
+            break;
+        case 'c':
+            parsed = parseNumber(value, options.compressedPercent, 100U);
+            break;
+        case 'p':
+            parsed = parseNumber(value, options.part, 9U);
+            break;
+        case 'l':
+            parsed = parseNumber(value, options.level, 9U);
+            break;
+        case 'r':
+            parsed = parseNumber(value, options.seed, UINT64_MAX);
+            break;
+        default:
+            cerr << "Unknown option '"sv << arg << "'!"sv << endl << endl;
+            usage(cerr, program);
+            return eINVALID_ARGS;
+        }
+        if (!parsed) {
+            cerr << "Invalid argument for option '"sv << arg << "'!"sv << endl
+                 << endl;
+            usage(cerr, program);
+            return eINVALID_ARGS;
+        }
+    }
+    if (argc - argi != 1) {
+        usage(cerr, program);
+        return eWRONG_ARGC;
+    }
+    if (options.minSize > options.maxSize) {
+        cerr << "Minimum size must not be larger than maximum size!"sv << endl
+             << endl;
+        return eINVALID_ARGS;
+    }
+
+    path const obbfile(argv[argi]);
+    try {
+        size_t const total = writeSyntheticObb(obbfile, options);
+        cout << "Wrote "sv << obbfile << ": "sv << file_size(obbfile)
+             << " bytes, with "sv << total
+             << " bytes of uncompressed files."sv << endl;
+    } catch (Obb_writer::Error) {
+        cerr << "OBB would be larger than 4 GiB!"sv << endl;
+        boost::system::error_code err;
+        remove(obbfile, err);
+        return eOBB_TOO_LARGE;
+    } catch (std::exception const& except) {
+        cerr << "Could not write "sv << obbfile << ": "sv << except.what()
+             << endl;
+        boost::system::error_code err;
+        remove(obbfile, err);
+        return eOBB_NO_ACCESS;
+    }
+    return eOK;
+}
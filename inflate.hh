@@ -0,0 +1,100 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INFLATE_HH
+#define INFLATE_HH
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <vector>
+
+// Inflates the zlib stream in source directly into the length bytes at dest,
+// in a single call to zlib. The OBB file table gives the uncompressed size of
+// every file, so there is no need to grow the output as we go. Returns false
+// if the stream is corrupt, or if it does not inflate to exactly length bytes.
+[[nodiscard]] inline auto inflateInto(
+        std::string_view const source, char* dest, size_t const length) noexcept
+        -> bool {
+    // zlib does not like being handed a null output buffer, even if it is not
+    // going to write anything to it.
+    std::array<char, 1> dummy{};
+    char* const         output = length != 0 ? dest : dummy.data();
+    z_stream            strm{};
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    strm.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(source.data()));
+    strm.avail_in  = static_cast<uInt>(source.size());
+    strm.next_out  = reinterpret_cast<Bytef*>(output);
+    strm.avail_out = static_cast<uInt>(length);
+    if (inflateInit(&strm) != Z_OK) {
+        return false;
+    }
+    int const result = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+    return result == Z_STREAM_END && strm.total_out == length;
+}
+
+// Inflates source into buffer, which is resized to hold exactly length bytes.
+// The buffer is meant to be reused across calls, so that its memory gets
+// allocated only a few times.
+[[nodiscard]] inline auto inflateInto(
+        std::string_view const source, std::vector<char>& buffer,
+        size_t const length) -> bool {
+    buffer.resize(length);
+    return inflateInto(source, buffer.data(), length);
+}
+
+// Inflates source a chunk at a time into buffer, and hands each chunk to func
+// as a std::string_view, valid until func returns. This keeps the inflated
+// data in cache for whoever consumes it, and the buffer stays small whatever
+// the size of the file. Returns false if the stream is corrupt, or if it does
+// not inflate to exactly length bytes.
+template <typename Func>
+[[nodiscard]] inline auto inflateChunks(
+        std::string_view const source, std::vector<char>& buffer,
+        size_t const length, Func&& func) -> bool {
+    constexpr static const size_t chunkSize = 64U * 1024U;
+    buffer.resize(std::max(size_t(1), std::min(length, chunkSize)));
+    z_stream strm{};
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    strm.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(source.data()));
+    strm.avail_in = static_cast<uInt>(source.size());
+    if (inflateInit(&strm) != Z_OK) {
+        return false;
+    }
+    int result = Z_OK;
+    while (result == Z_OK) {
+        strm.next_out  = reinterpret_cast<Bytef*>(buffer.data());
+        strm.avail_out = static_cast<uInt>(buffer.size());
+        result         = inflate(&strm, Z_NO_FLUSH);
+        size_t const have = buffer.size() - strm.avail_out;
+        if ((result != Z_OK && result != Z_STREAM_END)
+            || strm.total_out > length) {
+            break;
+        }
+        // Without progress, inflate returns Z_BUF_ERROR, ending the loop.
+        if (have != 0) {
+            func(std::string_view(buffer.data(), have));
+        }
+    }
+    inflateEnd(&strm);
+    return result == Z_STREAM_END && strm.total_out == length;
+}
+
+#endif
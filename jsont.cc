@@ -10,6 +10,14 @@
 
 #include "jsont.hh"
 
+#include <algorithm>
+#include <cstring>
+
+#if !defined(JSONT_NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#    define JSONT_X86_SIMD 1
+#    include <immintrin.h>
+#endif
+
 using std::stod;
 using std::stoll;
 using std::string;
@@ -31,9 +39,165 @@ namespace jsont {
     static inline auto is_exponent_introducer(const char c) -> bool {
         return c == 'E' || c == 'e';
     }
+    static inline auto is_whitespace(const char c) -> bool {
+        // IETF RFC4627
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+    static inline auto is_string_special(const char c) -> bool {
+        return c == '"' || c == '\\' || c == 0;
+    }
+
+    // Scanners for the two loops that dominate tokenizing: finding the end of
+    // a string (or an escape sequence in it), and skipping whitespace. Each
+    // returns a pointer to the first byte in [ptr, end) which is (for
+    // findStringSpecial) or is not (for skipWhitespace) in the set, or end if
+    // there is no such byte.
+    using Scanner = auto (*)(const char* ptr, const char* end) noexcept
+                    -> const char*;
+
+    static auto findStringSpecialScalar(
+            const char* ptr, const char* const end) noexcept -> const char* {
+        while (ptr != end && !is_string_special(*ptr)) {
+            ++ptr;
+        }
+        return ptr;
+    }
+
+    static auto skipWhitespaceScalar(
+            const char* ptr, const char* const end) noexcept -> const char* {
+        while (ptr != end && is_whitespace(*ptr)) {
+            ++ptr;
+        }
+        return ptr;
+    }
+
+#ifdef JSONT_X86_SIMD
+    // The vector loads below are all unaligned loads.
+    template <typename Vector>
+    static inline auto asVector(const char* ptr) noexcept -> Vector const* {
+        return static_cast<Vector const*>(static_cast<void const*>(ptr));
+    }
+
+    // Vectorized scanners, processing 16 (SSE2) or 32 (AVX2) bytes at a time;
+    // the tail of the input is left for the scalar versions, so as to never
+    // read past the end of the input.
+    __attribute__((target("sse2"))) static auto findStringSpecialSSE2(
+            const char* ptr, const char* const end) noexcept -> const char* {
+        __m128i const quote     = _mm_set1_epi8('"');
+        __m128i const backslash = _mm_set1_epi8('\\');
+        __m128i const zero      = _mm_setzero_si128();
+        for (; end - ptr >= 16; ptr += 16) {
+            __m128i const chunk = _mm_loadu_si128(asVector<__m128i>(ptr));
+            __m128i const found = _mm_or_si128(
+                    _mm_or_si128(
+                            _mm_cmpeq_epi8(chunk, quote),
+                            _mm_cmpeq_epi8(chunk, backslash)),
+                    _mm_cmpeq_epi8(chunk, zero));
+            auto const mask = static_cast<unsigned>(_mm_movemask_epi8(found));
+            if (mask != 0) {
+                return ptr + __builtin_ctz(mask);
+            }
+        }
+        return findStringSpecialScalar(ptr, end);
+    }
+
+    __attribute__((target("sse2"))) static auto skipWhitespaceSSE2(
+            const char* ptr, const char* const end) noexcept -> const char* {
+        __m128i const space   = _mm_set1_epi8(' ');
+        __m128i const tab     = _mm_set1_epi8('\t');
+        __m128i const cr      = _mm_set1_epi8('\r');
+        __m128i const newline = _mm_set1_epi8('\n');
+        for (; end - ptr >= 16; ptr += 16) {
+            __m128i const chunk = _mm_loadu_si128(asVector<__m128i>(ptr));
+            __m128i const found = _mm_or_si128(
+                    _mm_or_si128(
+                            _mm_cmpeq_epi8(chunk, space),
+                            _mm_cmpeq_epi8(chunk, tab)),
+                    _mm_or_si128(
+                            _mm_cmpeq_epi8(chunk, cr),
+                            _mm_cmpeq_epi8(chunk, newline)));
+            auto const mask = ~static_cast<unsigned>(_mm_movemask_epi8(found))
+                              & 0xffffU;
+            if (mask != 0) {
+                return ptr + __builtin_ctz(mask);
+            }
+        }
+        return skipWhitespaceScalar(ptr, end);
+    }
+
+    __attribute__((target("avx2"))) static auto findStringSpecialAVX2(
+            const char* ptr, const char* const end) noexcept -> const char* {
+        __m256i const quote     = _mm256_set1_epi8('"');
+        __m256i const backslash = _mm256_set1_epi8('\\');
+        __m256i const zero      = _mm256_setzero_si256();
+        for (; end - ptr >= 32; ptr += 32) {
+            __m256i const chunk = _mm256_loadu_si256(asVector<__m256i>(ptr));
+            __m256i const found = _mm256_or_si256(
+                    _mm256_or_si256(
+                            _mm256_cmpeq_epi8(chunk, quote),
+                            _mm256_cmpeq_epi8(chunk, backslash)),
+                    _mm256_cmpeq_epi8(chunk, zero));
+            auto const mask
+                    = static_cast<unsigned>(_mm256_movemask_epi8(found));
+            if (mask != 0) {
+                return ptr + __builtin_ctz(mask);
+            }
+        }
+        return findStringSpecialScalar(ptr, end);
+    }
+
+    __attribute__((target("avx2"))) static auto skipWhitespaceAVX2(
+            const char* ptr, const char* const end) noexcept -> const char* {
+        __m256i const space   = _mm256_set1_epi8(' ');
+        __m256i const tab     = _mm256_set1_epi8('\t');
+        __m256i const cr      = _mm256_set1_epi8('\r');
+        __m256i const newline = _mm256_set1_epi8('\n');
+        for (; end - ptr >= 32; ptr += 32) {
+            __m256i const chunk = _mm256_loadu_si256(asVector<__m256i>(ptr));
+            __m256i const found = _mm256_or_si256(
+                    _mm256_or_si256(
+                            _mm256_cmpeq_epi8(chunk, space),
+                            _mm256_cmpeq_epi8(chunk, tab)),
+                    _mm256_or_si256(
+                            _mm256_cmpeq_epi8(chunk, cr),
+                            _mm256_cmpeq_epi8(chunk, newline)));
+            auto const mask
+                    = ~static_cast<unsigned>(_mm256_movemask_epi8(found));
+            if (mask != 0) {
+                return ptr + __builtin_ctz(mask);
+            }
+        }
+        return skipWhitespaceScalar(ptr, end);
+    }
+#endif
+
+    struct Scanners {
+        Scanner findStringSpecial;
+        Scanner skipWhitespace;
+    };
+
+    // Picks the best scanners the CPU we are running on supports.
+    static auto selectScanners() noexcept -> Scanners {
+#ifdef JSONT_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return {findStringSpecialAVX2, skipWhitespaceAVX2};
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return {findStringSpecialSSE2, skipWhitespaceSSE2};
+        }
+#endif
+        return {findStringSpecialScalar, skipWhitespaceScalar};
+    }
+
+    static Scanners const scanners = selectScanners();
 
     inline auto Tokenizer::readAtom(string_view atom, Token token) noexcept
             -> Token {
+        // We need a byte past the atom to see if it ends there.
+        if (!_final && availableInput() <= atom.length()) {
+            return needMoreInput(_offset - 1);
+        }
         if (availableInput() < atom.length()) {
             return setError(Tokenizer::PrematureEndOfInput);
         }
@@ -73,13 +237,6 @@ namespace jsont {
         return "Unspecified error"sv;
     }
 
-    auto Tokenizer::dataValue() const noexcept -> string_view {
-        if (!hasValue()) {
-            return translateToken(_token);
-        }
-        return _value;
-    }
-
     auto Tokenizer::floatValue() const noexcept -> double {
         if (!hasValue()) {
             return _token == jsont::True ? 1.0 : 0.0;
@@ -113,33 +270,29 @@ namespace jsont {
     }
 
     inline void Tokenizer::skipWS() noexcept {
-        while (!endOfInput()) {
-            char b = _input[_offset++];
-            switch (b) {
-            case ' ':
-            case '\t':
-            case '\r':
-            case '\n':
-                // IETF RFC4627
-                // ignore whitespace
-                break;
-            default:
-                // Put character back and return
-                --_offset;
-                return;
-            }
+        // Most whitespace runs are short, or even empty; only bother with the
+        // vectorized scanner if there is more than one whitespace character.
+        if (endOfInput() || !is_whitespace(_input[_offset])) {
+            return;
+        }
+        _offset++;
+        if (endOfInput() || !is_whitespace(_input[_offset])) {
+            return;
         }
+        const char* const begin = _input.data();
+        _offset = static_cast<size_t>(
+                scanners.skipWhitespace(
+                        begin + _offset, begin + _input.length())
+                - begin);
     }
 
     inline auto Tokenizer::readDigits(size_t digits) noexcept -> bool {
-        while (!endOfInput() && safe_isdigit(_input[_offset++])) {
+        // The byte that terminates the digit sequence is not part of the
+        // number, even if it is the last byte of the input.
+        while (!endOfInput() && safe_isdigit(_input[_offset])) {
+            _offset++;
             digits++;
         }
-        // Rewind the byte that terminated this digit sequence, unless it was
-        // terminated by end-of-input.
-        if (!endOfInput()) {
-            --_offset;
-        }
         return digits > 0;
     }
 
@@ -160,7 +313,7 @@ namespace jsont {
         setToken(jsont::Float);
         // Skip '.'
         _offset++;
-        if (is_plus_minus(_input[_offset])) {
+        if (!endOfInput() && is_plus_minus(_input[_offset])) {
             // Skip optional '+'/'-'
             _offset++;
         }
@@ -177,8 +330,13 @@ namespace jsont {
         // Note: JSON grammar allows for a JSON file with a single number
         // surrounded by optional whitespace. Thus, we cannot return
         // end-of-input here or we will miss the number.
-        if (!readDigits(static_cast<size_t>(have_digit)) || !readFraction()
-            || !readExponent()) {
+        bool const valid = readDigits(static_cast<size_t>(have_digit))
+                           && readFraction() && readExponent();
+        // The number may go on in the next chunk.
+        if (endOfChunk()) {
+            return needMoreInput(token_start);
+        }
+        if (!valid) {
             return setError(MalformedNumberLiteral);
         }
         _value = _input.substr(token_start, _offset - token_start);
@@ -186,28 +344,43 @@ namespace jsont {
     }
 
     auto Tokenizer::readString(char b, size_t token_start) noexcept -> Token {
-        while (!endOfInput()) {
+        const char* const begin = _input.data();
+        const char* const end   = begin + _input.length();
+        while (true) {
+            // Skip ahead to the next double-quote, backslash or null byte.
+            _offset = static_cast<size_t>(
+                    scanners.findStringSpecial(begin + _offset, end) - begin);
+            if (endOfChunk()) {
+                return needMoreInput(token_start);
+            }
+            if (endOfInput()) {
+                return setError(UnterminatedString);
+            }
             b = _input[_offset++];
 
             if (b == '\\') {
+                if (endOfChunk()) {
+                    return needMoreInput(token_start);
+                }
                 if (endOfInput()) {
                     return setError(PrematureEndOfInput);
                 }
                 _offset++;
             } else if (b == '"') {
                 break;
-            } else if (b == 0) {
+            } else {
                 return setError(InvalidByte);
             }
         }
 
-        if (b != '"') {
-            return setError(UnterminatedString);
-        }
         // Note: double-quotes are included in the token value.
         _value = _input.substr(token_start, _offset - token_start);
 
         skipWS();
+        // A colon in the next chunk would make this a field name.
+        if (endOfChunk()) {
+            return needMoreInput(token_start);
+        }
         // is this a field name?
         if (!endOfInput()) {
             b = _input[_offset++];
@@ -230,6 +403,35 @@ namespace jsont {
     }
 
     auto Tokenizer::next() noexcept -> Token {
+        Token token = readToken();
+        if (!_carrying) {
+            return token;
+        }
+        // A token split between chunks is completed in the carry buffer, with
+        // as little of the chunk as it needs: the chunk is copied a piece at a
+        // time, each piece as large as what is already in the buffer. The
+        // buffer has room for the whole chunk, so this never allocates.
+        constexpr static const size_t minPiece = 64U;
+        while (token == NeedMoreInput
+               && _carry.size() < _carried + _chunk.size()) {
+            size_t const used   = _carry.size() - _carried;
+            size_t const length = std::min(
+                    _chunk.size() - used, std::max(_carry.size(), minPiece));
+            _carry.append(_chunk.substr(used, length));
+            _input = _carry;
+            token  = readToken();
+        }
+        // Once past the bytes carried over, the rest of the chunk is read in
+        // place.
+        if (_offset >= _carried) {
+            _input    = _chunk;
+            _offset   = _offset - _carried;
+            _carrying = false;
+        }
+        return token;
+    }
+
+    auto Tokenizer::readToken() noexcept -> Token {
         //
         // { } [ ] n t f "
         //         | | | |
@@ -238,6 +440,9 @@ namespace jsont {
         //         | +- r u e
         //         +- u l l
         //
+        if (_token != NeedMoreInput) {
+            _previous = _token;
+        }
         skipWS();
         while (!endOfInput()) {
             size_t token_start = _offset;
@@ -271,7 +476,33 @@ namespace jsont {
             }
         }
 
+        if (!_final) {
+            return needMoreInput(_offset);
+        }
         return setToken(End);
     }
 
+    void Tokenizer::feed(string_view chunk) {
+        // Keep the start of a token split between chunks, and whatever of the
+        // previous chunk was not yet copied to complete it.
+        if (_carrying) {
+            size_t const used = _carry.size() - _carried;
+            _carry.erase(0, _offset);
+            _carry.append(_chunk.substr(used));
+        } else {
+            _carry.assign(_input.substr(_offset));
+        }
+        _offset   = 0;
+        _final    = false;
+        _carrying = !_carry.empty();
+        if (!_carrying) {
+            _input = chunk;
+            return;
+        }
+        _carry.reserve(_carry.size() + chunk.size());
+        _carried = _carry.size();
+        _chunk   = chunk;
+        _input   = _carry;
+    }
+
 }    // namespace jsont
@@ -11,9 +11,10 @@
 #ifndef JSONT_CXX_INCLUDED
 #define JSONT_CXX_INCLUDED
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 
 namespace jsont {
     // Tokens
@@ -31,12 +32,30 @@ namespace jsont {
         String,         // string value
         FieldName,      // field name
         Error,          // An error occured (see `error()` for details)
-        Comma
+        Comma,
+        NeedMoreInput    // Input ended inside a token; see `feed()`
     };
 
-    // Reads a sequence of bytes and produces tokens and values while doing so
+    // Spelling of each token, indexed by token. Tokens which have a value
+    // are spelled as a placeholder.
+    inline constexpr std::array<std::string_view, NeedMoreInput + 1>
+            TokenSpellings{
+            std::string_view("<<EOF>>"),    std::string_view("{"),
+            std::string_view("}"),          std::string_view("["),
+            std::string_view("]"),          std::string_view("true"),
+            std::string_view("false"),      std::string_view("null"),
+            std::string_view("<<int>>"),    std::string_view("<<float>>"),
+            std::string_view("<<string>>"), std::string_view("<<field name>>"),
+            std::string_view("<<error>>"),  std::string_view(","),
+            std::string_view("<<need more input>>")};
+
+    // Reads a sequence of bytes and produces tokens and values while doing so.
+    // The input can be given all at once, to the constructor or to `reset()`,
+    // or in chunks, with `feed()` and `finish()`.
     class Tokenizer {
     public:
+        // Creates a tokenizer for chunked input, which has no input yet.
+        Tokenizer() noexcept;
         Tokenizer(const char* bytes, size_t length) noexcept;
         explicit Tokenizer(std::string_view slice) noexcept;
 
@@ -51,6 +70,21 @@ namespace jsont {
         void reset(const char* bytes, size_t length) noexcept;
         void reset(std::string_view slice) noexcept;
 
+        // Adds a chunk of input. Until `finish()` is called, `next()` returns
+        // NeedMoreInput instead of a token that could continue in the next
+        // chunk, and it returns the whole token once that chunk is fed. The
+        // chunk must stay valid until the next call to `feed()`, as must the
+        // values of the tokens read from it. The bytes of a token split
+        // between chunks are copied into an internal buffer, along with only
+        // as much of the next chunk as it takes to complete the token; the
+        // rest of that chunk is read in place. Feeding an empty chunk copies
+        // them right away, so the last chunk can be released.
+        void feed(std::string_view chunk);
+
+        // Marks the end of the chunked input: from then on, the end of the
+        // last chunk is the end of the input.
+        void finish() noexcept;
+
         // True if the current token has a value
         auto hasValue() const noexcept -> bool;
 
@@ -100,8 +134,10 @@ namespace jsont {
         auto inputSize() const noexcept -> size_t;
 
     private:
-        auto translateToken(Token tok) const noexcept -> std::string_view;
+        static constexpr auto translateToken(Token tok) noexcept
+                -> std::string_view;
 
+        auto readToken() noexcept -> Token;
         void skipWS() noexcept;
         auto readDigits(size_t digits) noexcept -> bool;
         auto readFraction() noexcept -> bool;
@@ -113,29 +149,39 @@ namespace jsont {
         auto readAtom(std::string_view atom, Token token) noexcept -> Token;
         auto availableInput() const noexcept -> size_t;
         auto endOfInput() const noexcept -> bool;
+        auto endOfChunk() const noexcept -> bool;
         auto setToken(Token t) noexcept -> Token;
         auto setError(ErrorCode error) noexcept -> Token;
-        void initConverter() noexcept;
-
-        std::unordered_map<Token, std::string> _convert;
-        std::string_view                       _input;
-        std::string_view                       _value;
-        size_t                                 _offset;
-        Token                                  _token;
-        ErrorCode                              _error;
+        auto needMoreInput(size_t token_start) noexcept -> Token;
+
+        std::string_view _input;
+        std::string_view _value;
+        std::string      _carry;    // Holds tokens split between chunks
+        std::string_view _chunk;    // Last chunk fed, while reading _carry
+        size_t           _carried;    // Bytes in _carry from earlier chunks
+        size_t           _offset;
+        Token            _token;
+        Token            _previous;    // Last token other than NeedMoreInput
+        ErrorCode        _error;
+        bool             _final;    // False while more chunks may follow
+        bool             _carrying;    // True while reading _carry
     };
 
     // ------------------- internal ---------------------
 
+    inline Tokenizer::Tokenizer() noexcept
+            : _carried(0), _offset(0), _token(End), _previous(End),
+              _error(UnspecifiedError), _final(false), _carrying(false) {}
+
     inline Tokenizer::Tokenizer(const char* bytes, size_t length) noexcept
-            : _offset(0), _token(End), _error(UnspecifiedError) {
-        initConverter();
+            : _carried(0), _offset(0), _token(End), _previous(End),
+              _error(UnspecifiedError), _final(true), _carrying(false) {
         reset(bytes, length);
     }
 
     inline Tokenizer::Tokenizer(std::string_view slice) noexcept
-            : _offset(0), _token(End), _error(UnspecifiedError) {
-        initConverter();
+            : _carried(0), _offset(0), _token(End), _previous(End),
+              _error(UnspecifiedError), _final(true), _carrying(false) {
         reset(slice);
     }
 
@@ -148,13 +194,20 @@ namespace jsont {
     }
 
     inline void Tokenizer::reset(std::string_view slice) noexcept {
-        _input  = slice;
-        _offset = 0;
-        _error  = UnspecifiedError;
+        _input    = slice;
+        _offset   = 0;
+        _token    = End;
+        _error    = UnspecifiedError;
+        _final    = true;
+        _carrying = false;
         // Advance to first token
         next();
     }
 
+    inline void Tokenizer::finish() noexcept {
+        _final = true;
+    }
+
     inline auto Tokenizer::hasValue() const noexcept -> bool {
         return _token >= Integer && _token <= FieldName;
     }
@@ -167,20 +220,28 @@ namespace jsont {
         return _token == True;
     }
 
-    inline auto Tokenizer::translateToken(Token tok) const noexcept
+    constexpr auto Tokenizer::translateToken(Token tok) noexcept
             -> std::string_view {
-        return _convert.find(tok)->second;
+        return TokenSpellings[tok];
+    }
+
+    inline auto Tokenizer::dataValue() const noexcept -> std::string_view {
+        if (!hasValue()) {
+            return translateToken(_token);
+        }
+        return _value;
     }
 
     inline auto Tokenizer::readComma() noexcept -> Token {
-        if (_token == ObjectStart || _token == ArrayStart || _token == Comma) {
+        if (_previous == ObjectStart || _previous == ArrayStart
+            || _previous == Comma) {
             return setError(UnexpectedComma);
         }
         return setToken(Comma);
     }
 
     inline auto Tokenizer::readEndBracket(Token token) noexcept -> Token {
-        if (_token == Comma) {
+        if (_previous == Comma) {
             return setError(UnexpectedTrailingComma);
         }
         return setToken(token);
@@ -194,6 +255,11 @@ namespace jsont {
         return _offset == _input.length();
     }
 
+    // True if we are at the end of a chunk, and more chunks may follow.
+    inline auto Tokenizer::endOfChunk() const noexcept -> bool {
+        return !_final && endOfInput();
+    }
+
     inline auto Tokenizer::setToken(Token t) noexcept -> Token {
         return _token = t;
     }
@@ -204,15 +270,11 @@ namespace jsont {
         return _token = Error;
     }
 
-    inline void Tokenizer::initConverter() noexcept {
-        using namespace std::literals::string_literals;
-        _convert = {{End, "<<EOF>>"s},       {ObjectStart, "{"s},
-                    {ObjectEnd, "}"s},       {ArrayStart, "["s},
-                    {ArrayEnd, "]"s},        {True, "true"s},
-                    {False, "false"s},       {Null, "null"s},
-                    {Integer, "<<int>>"s},   {Float, "<<float>>"s},
-                    {String, "<<string>>"s}, {FieldName, "<<field name>>"s},
-                    {Error, "<<error>>"s},   {Comma, ","s}};
+    // Rewinds to the start of a token that may continue in the next chunk.
+    inline auto Tokenizer::needMoreInput(size_t token_start) noexcept
+            -> Token {
+        _offset       = token_start;
+        return _token = NeedMoreInput;
     }
 
     inline auto Tokenizer::error() const noexcept -> Tokenizer::ErrorCode {
@@ -0,0 +1,236 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MANIFEST_HH
+#define MANIFEST_HH
+
+#include "endianio.hh"
+
+#include <boost/filesystem.hpp>
+
+#include <zlib.h>
+
+#ifndef _WIN32
+#    include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hash of the contents of a file, for change detection: the CRC-32 and the
+// Adler-32 of the data, side by side. It can be computed a chunk at a time.
+class Content_hash {
+public:
+    void update(std::string_view const data) noexcept {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        auto const* bytes = reinterpret_cast<Bytef const*>(data.data());
+        auto const  size  = static_cast<uInt>(data.size());
+        crc               = crc32(crc, bytes, size);
+        adler             = adler32(adler, bytes, size);
+    }
+    [[nodiscard]] auto value() const noexcept -> uint64_t {
+        return (uint64_t(crc) << 32U) | uint64_t(adler);
+    }
+
+private:
+    uLong crc   = 0U;
+    uLong adler = 1U;
+};
+
+[[nodiscard]] inline auto contentHash(std::string_view const data) noexcept
+        -> uint64_t {
+    Content_hash hash;
+    hash.update(data);
+    return hash.value();
+}
+
+// Size and modification time of an extracted file, as it was written. If a
+// file still has both, it has not been changed since. Times are in nanoseconds
+// where the system has them, as scripts can easily edit a file in the same
+// second it was extracted.
+struct Disk_stamp {
+    uint64_t size  = 0U;
+    int64_t  mtime = 0;
+
+    // Returns an empty stamp if the file cannot be found.
+    [[nodiscard]] static auto of(boost::filesystem::path const& fpath)
+            -> Disk_stamp {
+#ifndef _WIN32
+        struct stat info {};
+        if (::stat(fpath.c_str(), &info) != 0) {
+            return Disk_stamp{};
+        }
+#    ifdef __APPLE__
+        timespec const& mtime = info.st_mtimespec;
+#    else
+        timespec const& mtime = info.st_mtim;
+#    endif
+        constexpr int64_t const nanosPerSecond = 1000000000;
+        return Disk_stamp{
+                static_cast<uint64_t>(info.st_size),
+                mtime.tv_sec * nanosPerSecond + mtime.tv_nsec};
+#else
+        boost::system::error_code err;
+        Disk_stamp                stamp;
+        stamp.size = boost::filesystem::file_size(fpath, err);
+        if (err) {
+            return Disk_stamp{};
+        }
+        stamp.mtime = boost::filesystem::last_write_time(fpath, err);
+        return err ? Disk_stamp{} : stamp;
+#endif
+    }
+    [[nodiscard]] auto operator==(Disk_stamp const& other) const noexcept
+            -> bool {
+        return size == other.size && mtime == other.mtime;
+    }
+    [[nodiscard]] auto operator!=(Disk_stamp const& other) const noexcept
+            -> bool {
+        return !(*this == other);
+    }
+};
+
+// An OBB entry, as extracted: where it was in the OBB, and what was written
+// for it. The hash is of the extracted file, as it was written, so that it can
+// be checked without knowing how the OBB formats its contents.
+struct Manifest_entry {
+    std::string fname;
+    uint32_t    offset     = 0U;
+    uint32_t    complength = 0U;
+    uint32_t    fulllength = 0U;
+    bool        compressed = false;
+    uint64_t    hash       = 0U;
+    Disk_stamp  stamp;
+
+    [[nodiscard]] auto name() const noexcept -> std::string const& {
+        return fname;
+    }
+};
+
+// Record of an extraction, which xtractobb saves in FileTable.bin so that
+// repackobb can rebuild the OBB. It is a small binary file, little endian:
+//
+//     char[8]  "XOBBMan1"
+//     uint32   number of entries
+//     uint32   size of the name table
+//     uint64   size of the OBB
+//     uint64   hash of the file table of the OBB
+//     uint64   size of the reference file (0 if there is none)
+//     int64    modification time of the reference file
+//     entries, 48 bytes each, in the order of their data in the OBB:
+//         uint32   offset and length of the name in the name table
+//         uint32   offset, compressed and uncompressed length in the OBB
+//         uint32   flags; bit 0 is set for compressed entries
+//         uint64   hash of the extracted file
+//         uint64   size of the extracted file
+//         int64    modification time of the extracted file
+//     name table
+//
+// Entries have a fixed size, so any entry can be found without reading the
+// ones before it.
+struct Manifest {
+    enum Error { eBAD_MANIFEST };
+
+    static constexpr const std::string_view Signature{"XOBBMan1"};
+    static constexpr const size_t           HeaderSize = 48;
+    static constexpr const size_t           EntrySize  = 48;
+
+    uint64_t                    obbSize      = 0U;
+    uint64_t                    obbTableHash = 0U;
+    Disk_stamp                  reference;
+    std::vector<Manifest_entry> entries;
+
+    [[nodiscard]] auto serialize() const -> std::string {
+        size_t namesSize = 0;
+        for (auto const& entry : entries) {
+            namesSize += entry.fname.size();
+        }
+        std::string result(HeaderSize + entries.size() * EntrySize, '\0');
+        result.reserve(result.size() + namesSize);
+        auto it = result.begin();
+        std::copy(Signature.cbegin(), Signature.cend(), it);
+        it += Signature.size();
+        Write4(it, static_cast<uint32_t>(entries.size()));
+        Write4(it, static_cast<uint32_t>(namesSize));
+        Write8(it, obbSize);
+        Write8(it, obbTableHash);
+        Write8(it, reference.size);
+        Write8(it, static_cast<uint64_t>(reference.mtime));
+        uint32_t nameOffset = 0U;
+        for (auto const& entry : entries) {
+            Write4(it, nameOffset);
+            Write4(it, static_cast<uint32_t>(entry.fname.size()));
+            Write4(it, entry.offset);
+            Write4(it, entry.complength);
+            Write4(it, entry.fulllength);
+            Write4(it, entry.compressed ? 1U : 0U);
+            Write8(it, entry.hash);
+            Write8(it, entry.stamp.size);
+            Write8(it, static_cast<uint64_t>(entry.stamp.mtime));
+            nameOffset += static_cast<uint32_t>(entry.fname.size());
+        }
+        for (auto const& entry : entries) {
+            result += entry.fname;
+        }
+        return result;
+    }
+
+    // Throws Error if the data is not a valid manifest.
+    [[nodiscard]] static auto parse(std::string_view const data) -> Manifest {
+        if (data.size() < HeaderSize
+            || data.substr(0, Signature.size()) != Signature) {
+            throw Error{eBAD_MANIFEST};
+        }
+        auto           it        = data.cbegin() + Signature.size();
+        uint32_t const count     = Read4(it);
+        uint32_t const namesSize = Read4(it);
+        size_t const   namesPos  = HeaderSize + size_t(count) * EntrySize;
+        if (data.size() != namesPos + namesSize) {
+            throw Error{eBAD_MANIFEST};
+        }
+        std::string_view const names = data.substr(namesPos);
+
+        Manifest result;
+        result.obbSize         = Read8(it);
+        result.obbTableHash    = Read8(it);
+        result.reference.size  = Read8(it);
+        result.reference.mtime = static_cast<int64_t>(Read8(it));
+        result.entries.resize(count);
+        for (auto& entry : result.entries) {
+            uint32_t const nameOffset = Read4(it);
+            uint32_t const nameLength = Read4(it);
+            if (nameOffset > names.size()
+                || nameLength > names.size() - nameOffset) {
+                throw Error{eBAD_MANIFEST};
+            }
+            entry.fname       = names.substr(nameOffset, nameLength);
+            entry.offset      = Read4(it);
+            entry.complength  = Read4(it);
+            entry.fulllength  = Read4(it);
+            entry.compressed  = (Read4(it) & 1U) != 0U;
+            entry.hash        = Read8(it);
+            entry.stamp.size  = Read8(it);
+            entry.stamp.mtime = static_cast<int64_t>(Read8(it));
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OBBARCHIVE_HH
+#define OBBARCHIVE_HH
+
+#include "endianio.hh"
+#include "fileentry.hh"
+#include "inflate.hh"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Read-only view of an OBB file. The file is memory-mapped and validated once
+// on construction; after that, entries can be looked up by name in constant
+// time, or iterated in the order their data is stored in the file.
+class ObbArchive {
+public:
+    // Thrown by the constructor if the file is not a valid OBB, and by
+    // Entry_view::contents if a file does not inflate correctly. The last
+    // ones are only reported by checkLayout.
+    enum Error {
+        eNO_SIGNATURE,
+        eBAD_LENGTH,
+        eBAD_FILE_TABLE,
+        eBAD_ENTRY,
+        eBAD_DATA,
+        eOUT_OF_BOUNDS,
+        eMISALIGNED,
+        eOVERLAPPING,
+        eUNSORTED
+    };
+
+    static constexpr const size_t HeaderSize = 16;
+
+    // Lazily decompressed contents of an entry. The entry is only inflated
+    // when its contents are first requested, and the view owns the inflated
+    // data. Uncompressed entries are viewed directly in the mapped file.
+    class Entry_view {
+    public:
+        Entry_view() noexcept = default;
+        explicit Entry_view(XFile_entry const* _entry) noexcept
+                : entry(_entry) {}
+
+        // False if the entry was not found in the archive.
+        explicit operator bool() const noexcept {
+            return entry != nullptr;
+        }
+        [[nodiscard]] auto file() const noexcept -> XFile_entry const& {
+            return *entry;
+        }
+        // Uncompressed size, known without inflating the entry.
+        [[nodiscard]] auto size() const noexcept -> size_t {
+            return entry->fulllength;
+        }
+        [[nodiscard]] auto contents() -> std::string_view {
+            if (!entry->compressed) {
+                return entry->file();
+            }
+            if (!inflated) {
+                if (!inflateInto(entry->file(), buffer, entry->fulllength)) {
+                    throw Error{eBAD_DATA};
+                }
+                inflated = true;
+            }
+            return std::string_view(buffer.data(), buffer.size());
+        }
+
+    private:
+        XFile_entry const* entry = nullptr;
+        std::vector<char>  buffer;
+        bool               inflated = false;
+    };
+
+    explicit ObbArchive(boost::filesystem::path const& obbfile)
+            : source(obbfile) {
+        std::string_view const oggview(source.data(), source.size());
+        if (oggview.size() < HeaderSize
+            || oggview.substr(0, 8) != std::string_view("AP_Pack!")) {
+            throw Error{eNO_SIGNATURE};
+        }
+        if (Read4(oggview.cbegin() + 8) != oggview.size()) {
+            throw Error{eBAD_LENGTH};
+        }
+        uint32_t const htbl = Read4(oggview.cbegin() + 12);
+        if (htbl < HeaderSize || htbl > oggview.size()
+            || (oggview.size() - htbl) % XFile_entry::EntrySize != 0) {
+            throw Error{eBAD_FILE_TABLE};
+        }
+
+        entries.reserve((oggview.size() - htbl) / XFile_entry::EntrySize);
+        for (const auto* it = oggview.cbegin() + htbl; it != oggview.cend();
+             it += XFile_entry::EntrySize) {
+            // The entry constructor does not check its input.
+            const auto* ptr = it;
+            for (int ii = 0; ii < 2; ii++) {
+                uint32_t const offset = Read4(ptr);
+                uint32_t const length = Read4(ptr);
+                if (offset > htbl || length > htbl - offset) {
+                    throw Error{eBAD_ENTRY};
+                }
+            }
+            entries.emplace_back(it, oggview);
+        }
+
+        // Sort by data order in file, to improve OS prefetching.
+        std::sort(entries.begin(), entries.end(), [](auto& lhs, auto& rhs) {
+            return lhs.file().data() < rhs.file().data();
+        });
+        index.reserve(entries.size());
+        for (auto const& entry : entries) {
+            index.emplace(entry.name(), &entry);
+        }
+    }
+
+    // The index points into the entry list.
+    ObbArchive(ObbArchive const&) = delete;
+    ObbArchive(ObbArchive&&)      = delete;
+    auto operator=(ObbArchive const&) -> ObbArchive& = delete;
+    auto operator=(ObbArchive&&) -> ObbArchive& = delete;
+    ~ObbArchive() noexcept                      = default;
+
+    // The whole OBB file.
+    [[nodiscard]] auto data() const noexcept -> std::string_view {
+        return std::string_view(source.data(), source.size());
+    }
+
+    // The file table of the OBB, as stored in the file.
+    [[nodiscard]] auto fileTable() const noexcept -> std::string_view {
+        std::string_view const oggview = data();
+        return oggview.substr(Read4(oggview.cbegin() + 12));
+    }
+
+    // Entries, sorted by the position of their data in the file.
+    [[nodiscard]] auto files() const noexcept
+            -> std::vector<XFile_entry> const& {
+        return entries;
+    }
+    [[nodiscard]] auto begin() const noexcept {
+        return entries.cbegin();
+    }
+    [[nodiscard]] auto end() const noexcept {
+        return entries.cend();
+    }
+    [[nodiscard]] auto size() const noexcept -> size_t {
+        return entries.size();
+    }
+
+    // Checks the parts of the layout that the constructor lets through, as
+    // files can still be read despite them: that names and data are clear of
+    // the header, that data is 16-byte aligned, that no two names or data
+    // overlap, and that the file table is sorted by name with no duplicates.
+    // Calls report(name, error) for each problem, and returns how many there
+    // were.
+    template <typename Report>
+    auto checkLayout(Report&& report) const -> size_t {
+        size_t numErrors = 0;
+        auto   fail      = [&](std::string_view const name, Error const err) {
+            report(name, err);
+            numErrors++;
+        };
+
+        // Names and data, as [begin, end) in the file, with their entry name.
+        struct Range {
+            uint32_t         begin;
+            uint32_t         end;
+            std::string_view name;
+        };
+        std::vector<Range> ranges;
+        ranges.reserve(2 * entries.size());
+        std::string_view const table = fileTable();
+        std::string_view       previous;
+        for (auto it = table.cbegin(); it != table.cend();) {
+            bool const     first      = it == table.cbegin();
+            uint32_t const nameOffset = Read4(it);
+            uint32_t const nameLength = Read4(it);
+            uint32_t const dataOffset = Read4(it);
+            uint32_t const dataLength = Read4(it);
+            it += 4;    // Uncompressed length
+            std::string_view const name
+                    = data().substr(nameOffset, nameLength);
+            if (!first && !(previous < name)) {
+                fail(name, eUNSORTED);
+            }
+            previous = name;
+            if (dataOffset % 16 != 0) {
+                fail(name, eMISALIGNED);
+            }
+            for (auto const& [offset, length] :
+                 {std::pair(nameOffset, nameLength),
+                  std::pair(dataOffset, dataLength)}) {
+                // Empty names and files take no space.
+                if (length == 0) {
+                    continue;
+                }
+                if (offset < HeaderSize) {
+                    fail(name, eOUT_OF_BOUNDS);
+                }
+                ranges.push_back(Range{offset, offset + length, name});
+            }
+        }
+        std::sort(ranges.begin(), ranges.end(), [](auto& lhs, auto& rhs) {
+            return lhs.begin < rhs.begin;
+        });
+        uint32_t covered = 0;
+        for (auto const& range : ranges) {
+            if (range.begin < covered) {
+                fail(range.name, eOVERLAPPING);
+            }
+            covered = std::max(covered, range.end);
+        }
+        return numErrors;
+    }
+
+    // Returns nullptr if there is no entry with the given name.
+    [[nodiscard]] auto find(std::string_view const name) const
+            -> XFile_entry const* {
+        auto const iter = index.find(name);
+        return iter == index.cend() ? nullptr : iter->second;
+    }
+
+    [[nodiscard]] auto open(std::string_view const name) const -> Entry_view {
+        return Entry_view(find(name));
+    }
+
+private:
+    boost::iostreams::mapped_file_source                     source;
+    std::vector<XFile_entry>                                 entries;
+    std::unordered_map<std::string_view, XFile_entry const*> index;
+};
+
+// Story files for Sorcery! part N are "SorceryN.json" (".minjson" in some
+// releases) and "SorceryN.inkcontent".
+// TODO: Main json file should be found from Info.plist file:
+//  main json filename = dict["StoryFilename"sv] + ".json"
+// TODO: inkcontent filename should be found from main json:
+// inkcontent filename = indexed-content/filename
+[[nodiscard]] inline auto isStoryFile(
+        std::string_view const fname, std::string_view const extension) noexcept
+        -> bool {
+    constexpr const std::string_view prefix("Sorcery");
+    return fname.size() == prefix.size() + 1 + extension.size()
+           && fname.compare(0, prefix.size(), prefix) == 0
+           && fname[prefix.size()] >= '0' && fname[prefix.size()] <= '9'
+           && fname.compare(prefix.size() + 1, extension.size(), extension)
+                      == 0;
+}
+
+[[nodiscard]] inline auto isMainJsonFile(std::string_view const fname) noexcept
+        -> bool {
+    return isStoryFile(fname, ".json") || isStoryFile(fname, ".minjson");
+}
+
+[[nodiscard]] inline auto isInkContentFile(
+        std::string_view const fname) noexcept -> bool {
+    return isStoryFile(fname, ".inkcontent");
+}
+
+struct Story_files {
+    XFile_entry const* mainJson   = nullptr;
+    XFile_entry const* inkContent = nullptr;
+};
+
+// Looks the story files up by name, instead of scanning the whole archive.
+[[nodiscard]] inline auto findStoryFiles(ObbArchive const& archive)
+        -> Story_files {
+    Story_files result;
+    std::string fname("SorceryN");
+    for (char digit = '0'; digit <= '9'; digit++) {
+        fname.back() = digit;
+        for (char const* ext : {".json", ".minjson"}) {
+            if (auto const* entry = archive.find(fname + ext)) {
+                result.mainJson = entry;
+            }
+        }
+        if (auto const* entry = archive.find(fname + ".inkcontent")) {
+            result.inkContent = entry;
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OBBWRITER_HH
+#define OBBWRITER_HH
+
+#include "endianio.hh"
+#include "fileentry.hh"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <array>
+#include <ios>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Writes an OBB file as described in ogg-format.md: the header, then the data
+// of each file, 16-byte aligned, in the order they are added; then their names,
+// and the file table, sorted by name. Files are written as they are added, so
+// only the file table is kept in memory. The writer counts the bytes written,
+// which is the offset of whatever is written next.
+class Obb_writer {
+public:
+    // Thrown if the OBB would not fit the 32-bit offsets of the format.
+    enum Error { eTOO_LARGE };
+
+    explicit Obb_writer(boost::filesystem::path const& obbfile)
+            : fout(obbfile, std::ios::out | std::ios::binary) {
+        if (!fout.good()) {
+            throw std::ios_base::failure("Could not create OBB file");
+        }
+        write("AP_Pack!", false);
+        write4(0U);    // Placeholder for file size
+        write4(0U);    // Placeholder for file table position
+    }
+
+    // Appends a file, with data as it is to be stored: compressed if
+    // compressed is true, in which case fulllength is its inflated size.
+    void addFile(
+            std::string name, std::string_view const data,
+            size_t const fulllength, bool const compressed) {
+        RFile_entry entry;
+        entry.fname      = std::move(name);
+        entry.compressed = compressed;
+        entry.fulllength = checkedSize(fulllength);
+        entry.fdata      = {offset, entry.fulllength, checkedSize(data.size())};
+        entries.push_back(std::move(entry));
+        write(data);
+    }
+
+    // Writes the file names and the file table, and fills in the header.
+    // Returns the size of the OBB. Throws std::ios_base::failure if anything
+    // written to the OBB, here or by addFile, did not make it to the file.
+    auto finish() -> uint32_t {
+        std::vector<uint32_t> nameOffsets;
+        nameOffsets.reserve(entries.size());
+        for (auto const& entry : entries) {
+            nameOffsets.push_back(offset);
+            write(entry.fname, false);
+        }
+        pad();
+        uint32_t const tablePos = offset;
+
+        // File table is sorted by name.
+        std::vector<size_t> order(entries.size());
+        for (size_t ii = 0; ii < order.size(); ii++) {
+            order[ii] = ii;
+        }
+        std::sort(order.begin(), order.end(), [this](auto lhs, auto rhs) {
+            return entries[lhs].name() < entries[rhs].name();
+        });
+        for (auto const index : order) {
+            RFile_entry const& entry = entries[index];
+            write4(nameOffsets[index]);
+            write4(static_cast<uint32_t>(entry.fname.size()));
+            write4(entry.fdata.offset);
+            write4(entry.fdata.complength);
+            write4(entry.fdata.fulllength);
+        }
+        fout.seekp(8);
+        Write4(fout, offset);
+        Write4(fout, tablePos);
+        fout.close();
+        if (!fout.good()) {
+            throw std::ios_base::failure("Could not write OBB file");
+        }
+        return offset;
+    }
+
+private:
+    [[nodiscard]] static auto checkedSize(size_t const size) -> uint32_t {
+        if (size > std::numeric_limits<uint32_t>::max()) {
+            throw Error{eTOO_LARGE};
+        }
+        return static_cast<uint32_t>(size);
+    }
+
+    void write(std::string_view const data, bool const align = true) {
+        fout.write(data.data(), static_cast<std::streamsize>(data.size()));
+        offset = checkedSize(size_t{offset} + data.size());
+        if (align) {
+            pad();
+        }
+    }
+
+    void write4(uint32_t const value) {
+        Write4(fout, value);
+        offset = checkedSize(size_t{offset} + 4U);
+    }
+
+    void pad() {
+        constexpr static const std::array<char, 16U> nullPadding{};
+        uint32_t const padding = (16U - offset % 16U) % 16U;
+        fout.write(nullPadding.data(), padding);
+        offset = checkedSize(size_t{offset} + padding);
+    }
+
+    boost::filesystem::ofstream fout;
+    std::vector<RFile_entry>    entries;
+    uint32_t                    offset = 0;
+};
+
+#endif
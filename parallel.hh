@@ -0,0 +1,227 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use for a "-j N" option. Zero means one thread
+// per hardware thread.
+[[nodiscard]] inline auto resolveJobCount(unsigned jobs) noexcept -> unsigned {
+    if (jobs == 0) {
+        jobs = std::thread::hardware_concurrency();
+    }
+    return std::max(jobs, 1U);
+}
+
+// More threads than this would only add contention; larger job counts are
+// capped to it.
+constexpr static const unsigned MaxJobs = 256;
+
+// Parses the argument of a "-j N" option. Returns false if it is not a valid
+// non-negative number, or if it does not fit in an unsigned. Values above
+// MaxJobs are capped to it.
+[[nodiscard]] inline auto parseJobCount(
+        std::string_view const arg, unsigned& jobs) noexcept -> bool {
+    if (arg.empty()) {
+        return false;
+    }
+    constexpr static const unsigned maxValue
+            = std::numeric_limits<unsigned>::max();
+    unsigned value = 0;
+    for (char const chr : arg) {
+        if (chr < '0' || chr > '9') {
+            return false;
+        }
+        auto const digit = static_cast<unsigned>(chr - '0');
+        if (value > (maxValue - digit) / 10U) {
+            return false;
+        }
+        value = value * 10U + digit;
+    }
+    jobs = std::min(value, MaxJobs);
+    return true;
+}
+
+// Runs work(index) for every index in [0, count) using up to jobs threads.
+// Each thread calls makeWorker() once to create its own worker, so that state
+// which is expensive to create or unsafe to share (such as zlib streams) is
+// kept per thread. Indices are handed out in increasing order. The first
+// exception thrown by a worker stops the distribution of new indices and is
+// rethrown on the calling thread once all workers are done.
+template <typename MakeWorker>
+void parallelFor(size_t const count, unsigned jobs, MakeWorker makeWorker) {
+    jobs = static_cast<unsigned>(std::min<size_t>(
+            resolveJobCount(jobs), std::max<size_t>(count, 1U)));
+    if (jobs == 1) {
+        auto work = makeWorker();
+        for (size_t ii = 0; ii < count; ii++) {
+            work(ii);
+        }
+        return;
+    }
+
+    std::atomic<size_t> nextIndex{0};
+    std::exception_ptr  failure;
+    std::mutex          failureMutex;
+
+    auto runWorker = [&]() {
+        try {
+            auto work = makeWorker();
+            for (size_t ii = nextIndex++; ii < count; ii = nextIndex++) {
+                work(ii);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+            nextIndex = count;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(jobs - 1);
+    for (unsigned ii = 1; ii < jobs; ii++) {
+        threads.emplace_back(runWorker);
+    }
+    runWorker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+// Runs work(index) for every index in [0, count) on up to jobs worker threads,
+// and passes each result to consume(index, result) on the calling thread, in
+// increasing index order. At most twice as many results as there are workers
+// are kept in memory at any time: workers wait for the consumer before taking
+// an index too far ahead of it. The first exception thrown by either a worker
+// or the consumer stops all processing and is rethrown once all workers are
+// done.
+template <typename MakeWorker, typename Consumer>
+void parallelOrdered(
+        size_t const count, unsigned jobs, MakeWorker makeWorker,
+        Consumer consume) {
+    jobs = static_cast<unsigned>(std::min<size_t>(
+            resolveJobCount(jobs), std::max<size_t>(count, 1U)));
+    if (jobs == 1) {
+        auto work = makeWorker();
+        for (size_t ii = 0; ii < count; ii++) {
+            consume(ii, work(ii));
+        }
+        return;
+    }
+
+    using Result        = decltype(makeWorker()(size_t{}));
+    size_t const window = 2U * jobs;
+    std::vector<std::optional<Result>> slots(window);
+
+    std::mutex              slotMutex;
+    std::condition_variable slotReady;
+    size_t                  nextIndex = 0;
+    size_t                  consumed  = 0;
+    std::exception_ptr      failure;
+
+    auto fail = [&](std::exception_ptr except) {
+        {
+            std::lock_guard<std::mutex> lock(slotMutex);
+            if (!failure) {
+                failure = std::move(except);
+            }
+        }
+        slotReady.notify_all();
+    };
+
+    auto runWorker = [&]() {
+        try {
+            auto work = makeWorker();
+            while (true) {
+                size_t index = 0;
+                {
+                    std::unique_lock<std::mutex> lock(slotMutex);
+                    slotReady.wait(lock, [&]() {
+                        return failure || nextIndex >= count
+                               || nextIndex < consumed + window;
+                    });
+                    if (failure || nextIndex >= count) {
+                        return;
+                    }
+                    index = nextIndex++;
+                }
+                Result result = work(index);
+                {
+                    std::lock_guard<std::mutex> lock(slotMutex);
+                    slots[index % window].emplace(std::move(result));
+                }
+                slotReady.notify_all();
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(jobs);
+    for (unsigned ii = 0; ii < jobs; ii++) {
+        threads.emplace_back(runWorker);
+    }
+    try {
+        for (size_t ii = 0; ii < count; ii++) {
+            std::optional<Result> result;
+            {
+                std::unique_lock<std::mutex> lock(slotMutex);
+                auto& slot = slots[ii % window];
+                slotReady.wait(lock, [&]() {
+                    return failure || slot.has_value();
+                });
+                if (failure) {
+                    break;
+                }
+                result.swap(slot);
+            }
+            consume(ii, std::move(*result));
+            {
+                std::lock_guard<std::mutex> lock(slotMutex);
+                consumed++;
+            }
+            slotReady.notify_all();
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+#endif
@@ -15,29 +15,30 @@
  *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "atomicwrite.hh"
+#include "parallel.hh"
 #include "prettyJson.hh"
 
 #include <boost/filesystem.hpp>
-#include <boost/filesystem/fstream.hpp>
-#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
 #include <string_view>
 #include <vector>
 
 using std::cerr;
 using std::cout;
 using std::endl;
-using std::ios;
-using std::istream;
+using std::lock_guard;
+using std::mutex;
 using std::ostream;
 using std::string_view;
 using std::vector;
 
 using namespace std::literals::string_view_literals;
 
-using boost::filesystem::ifstream;
-using boost::filesystem::ofstream;
 using boost::filesystem::path;
 
 enum ErrorCodes { eOK, eWRONG_ARGC, eINVALID_ARGS, eFILE_ERROR };
@@ -47,24 +48,127 @@ void usage(ostream& out, string_view const program) {
         << " -h\n"
            "Usage: "
         << program
-        << " -p|-w|-c jsonfile [...]\n\n"
+        << " [-j N] -p|-w|-c jsonfile [...]\n\n"
            "Where:\n"
            "\t-h\tDisplays this message.\n"
+           "\t-j N\tProcesses files using N threads; 0 means one per "
+           "hardware\n"
+           "\t\tthread. Defaults to 1.\n"
            "\t-p\tPretty prints the input JSON files.\n"
            "\t-w\tRemoves all whitespace from the input JSON files.\n"
-           "\t-c\tLike w, but adds a single space after ':'.\n\n";
+           "\t-c\tLike w, but adds a single space after ':'.\n\n"
+           "Each file is replaced only once it has been completely "
+           "processed.\n\n";
+}
+
+// Serializes console output from the worker threads.
+static mutex consoleMutex;
+
+// Reformats a JSON file in place. The input is mapped rather than read, and
+// the output is built in the output buffer, then written to a temporary file
+// which replaces the input once complete.
+[[nodiscard]] auto processFile(
+        path const& jsonfile, PrettyJSON const pretty, vector<char>& output)
+        -> bool {
+    if (!exists(jsonfile)) {
+        lock_guard<mutex> lock(consoleMutex);
+        cerr << "File "sv << jsonfile << " does not exist!"sv << endl << endl;
+        return false;
+    }
+    if (!is_regular_file(jsonfile)) {
+        lock_guard<mutex> lock(consoleMutex);
+        cerr << "Path "sv << jsonfile << " must be a file!"sv << endl << endl;
+        return false;
+    }
+    // A link is written through: the file it points to is replaced, and the
+    // link is left as it is.
+    boost::system::error_code err;
+    path const                target = canonical(jsonfile, err);
+    if (err) {
+        lock_guard<mutex> lock(consoleMutex);
+        cerr << "Could not resolve path "sv << jsonfile << "!"sv << endl
+             << endl;
+        return false;
+    }
+
+    output.clear();
+    {
+        // Empty files cannot be mapped, and have nothing to print anyway.
+        boost::iostreams::mapped_file_source fin;
+        string_view                          input;
+        if (file_size(target) != 0) {
+            try {
+                fin.open(target);
+            } catch (std::ios_base::failure const&) {
+                lock_guard<mutex> lock(consoleMutex);
+                cerr << "Could not open input file "sv << jsonfile
+                     << " for reading!"sv << endl
+                     << endl;
+                return false;
+            }
+            input = string_view(fin.data(), fin.size());
+        }
+        output.reserve(input.size() + input.size() / 2);
+        Json_buffer      sint(output);
+        jsont::Tokenizer reader(input.data(), input.size());
+        Json_printer     printer(pretty, 0U);
+        while (printer.print(sint, reader.current(), reader.dataValue())) {
+            reader.next();
+        }
+        // Printing stops early on malformed JSON; the file is then left as it
+        // is, rather than replaced by what was printed up to there.
+        if (reader.current() != jsont::End || !printer.balanced()) {
+            lock_guard<mutex> lock(consoleMutex);
+            cerr << "File "sv << jsonfile << " is not valid JSON: "sv
+                 << [&reader]() {
+                        switch (reader.current()) {
+                        case jsont::Error:
+                            return reader.errorMessage();
+                        case jsont::End:
+                            return "unexpected end of input"sv;
+                        default:
+                            return "unmatched closing bracket"sv;
+                        }
+                    }()
+                 << endl
+                 << endl;
+            return false;
+        }
+        // The mapping is closed here, as some systems will not replace a
+        // mapped file.
+    }
+
+    if (!writeFileAtomic(
+                target, string_view(output.data(), output.size()))) {
+        lock_guard<mutex> lock(consoleMutex);
+        cerr << "Could not write output file "sv << jsonfile << "!"sv << endl
+             << endl;
+        return false;
+    }
+    return true;
 }
 
 extern "C" auto main(int argc, char* argv[]) -> int;
 
 auto main(int argc, char* argv[]) -> int {
     string_view const program(argv[0]);
-    if (argc < 3) {
+    unsigned          jobs = 1;
+    int               argi = 1;
+    if (argi < argc && argv[argi] == "-j"sv) {
+        if (++argi == argc || !parseJobCount(argv[argi], jobs)) {
+            cerr << "Option '-j' requires a numeric argument!"sv << endl
+                 << endl;
+            usage(cerr, program);
+            return eINVALID_ARGS;
+        }
+        argi++;
+    }
+    if (argc - argi < 2) {
         usage(cerr, program);
         return eWRONG_ARGC;
     }
 
-    string_view const type(argv[1]);
+    string_view const type(argv[argi]);
     if (type == "-h"sv) {
         usage(cout, program);
         return eOK;
@@ -86,47 +190,20 @@ auto main(int argc, char* argv[]) -> int {
         return eCOMPACT;
     }();
 
-    unsigned num_errors = 0;
-    for (int ii = 2; ii < argc; ii++) {
-        path const jsonfile(argv[ii]);
-        if (!exists(jsonfile)) {
-            cerr << "File "sv << jsonfile << " does not exist!"sv << endl
-                 << endl;
-            num_errors++;
-            continue;
-        }
-        if (!is_regular_file(jsonfile)) {
-            cerr << "Path "sv << jsonfile << " must be a file!"sv << endl
-                 << endl;
-            num_errors++;
-            continue;
-        }
-
-        size_t const len = file_size(jsonfile);
-        ifstream     fin(jsonfile, ios::in | ios::binary);
-        if (!fin.good()) {
-            cerr << "Could not open input file "sv << jsonfile
-                 << " for reading!"sv << endl
-                 << endl;
-            num_errors++;
-            continue;
-        }
-
-        vector<char> buf(len);
-        fin.read(&buf[0], static_cast<std::streamsize>(len));
-        fin.close();
-
-        ofstream fout(jsonfile, ios::out | ios::binary);
-        if (!fout.good()) {
-            cerr << "Could not open output file "sv << jsonfile
-                 << " for writing!"sv << endl
-                 << endl;
-            num_errors++;
-            continue;
-        }
-        printJSON(buf, fout, pretty);
-        fout.close();
-    }
+    // Files are independent of each other, so they can be processed
+    // concurrently; each worker has its own output buffer.
+    std::atomic<unsigned> num_errors{0};
+    char* const* const    files = argv + argi + 1;
+    parallelFor(
+            static_cast<size_t>(argc - argi - 1), jobs,
+            [files, pretty, &num_errors]() {
+                return [files, pretty, &num_errors,
+                        output = vector<char>()](size_t index) mutable {
+                    if (!processFile(path(files[index]), pretty, output)) {
+                        num_errors++;
+                    }
+                };
+            });
 
     return (num_errors) > 0 ? eFILE_ERROR : eOK;
 }
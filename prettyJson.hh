@@ -23,9 +23,17 @@ enum PrettyJSON { eNO_WHITESPACE = -1, ePRETTY = 0, eCOMPACT = 1 };
 #include "jsont.hh"
 
 #include <boost/interprocess/streams/vectorstream.hpp>
-#include <boost/iostreams/filter/aggregate.hpp>
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/operations.hpp>
+#include <boost/iostreams/pipeline.hpp>
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 using vectorstream = boost::interprocess::basic_vectorstream<std::vector<char>>;
 
@@ -33,64 +41,106 @@ using vectorstream = boost::interprocess::basic_vectorstream<std::vector<char>>;
 #    define INDENT_CHAR '\t'
 #endif
 
-template <typename Dst>
-void printJSON(
-        jsont::Tokenizer& reader, Dst& sint, PrettyJSON const pretty,
-        size_t newlineForceIndent) {
-    size_t       indent    = 0;
-    bool         needValue = false;
-    jsont::Token tok       = reader.current();
+// Output buffer for printing JSON: bytes are appended straight to a vector,
+// with none of the formatting and sentry overhead of an ostream.
+class Json_buffer {
+public:
+    explicit Json_buffer(std::vector<char>& _buffer) noexcept
+            : buffer(_buffer) {}
 
-    auto printIndentedValue = [&needValue, &sint, &indent,
-                               &pretty](auto valuePrinter, bool newNeedValue) {
-        if (pretty == ePRETTY && (newNeedValue || !needValue)) {
-            sint << std::string(indent, INDENT_CHAR);
+    void append(std::string_view const text) {
+        buffer.insert(buffer.end(), text.cbegin(), text.cend());
+    }
+    void append(char const chr) {
+        buffer.push_back(chr);
+    }
+
+private:
+    std::vector<char>& buffer;
+};
+
+// Run of indentation characters that indentation is copied from.
+inline constexpr auto IndentSlab = []() {
+    std::array<char, 64> slab{};
+    for (auto& chr : slab) {
+        chr = INDENT_CHAR;
+    }
+    return slab;
+}();
+
+// Writes text to the JSON output, which is either a Json_buffer or an ostream.
+template <typename Dst, typename Text>
+inline void writeJSON(Dst& sint, Text const text) {
+    if constexpr (std::is_same_v<Dst, Json_buffer>) {
+        sint.append(text);
+    } else if constexpr (std::is_same_v<Text, char>) {
+        sint.put(text);
+    } else {
+        sint.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+}
+
+// JSON printer state. Tokens are printed one at a time, as they are read, so
+// that the printer can resume where it stopped when more input arrives.
+class Json_printer {
+public:
+    Json_printer(PrettyJSON const _pretty, size_t const _newlineForceIndent)
+            : pretty(_pretty), newlineForceIndent(_newlineForceIndent) {}
+
+    // Prints the current token of the reader. Returns false when the printer
+    // is done: at the end of the input, on an error, or on a closing bracket
+    // with no matching opening bracket. NeedMoreInput prints nothing.
+    template <typename Dst>
+    auto print(Dst& sint, jsont::Tokenizer const& reader) -> bool {
+        jsont::Token const tok = reader.current();
+        if (tok == jsont::Error) {
+            std::cerr << reader.errorMessage() << std::endl;
         }
-        needValue = newNeedValue;
-        valuePrinter();
-    };
-    auto printValueRaw = [&sint, &reader]() -> decltype(auto) {
-        return sint << reader.dataValue();
-    };
-    auto printValueObject
-            = [&printValueRaw, &sint, &reader, &pretty]() -> decltype(auto) {
-        printValueRaw() << ':';
-        if (pretty != eNO_WHITESPACE) {
-            sint << ' ';
+        return print(sint, tok, reader.dataValue());
+    }
+
+    // Prints a token with the given text, as print does for a token read from
+    // a reader, but without error messages.
+    template <typename Dst>
+    auto print(Dst& sint, jsont::Token const tok, std::string_view const value)
+            -> bool {
+        if (tok == jsont::NeedMoreInput) {
+            return true;
         }
-        return sint;
-    };
-    auto lineBreak = [&indent, &sint, &tok, &pretty, &newlineForceIndent]() {
-        if (tok != jsont::Comma
-            && (indent == newlineForceIndent || pretty == ePRETTY)) {
-            sint << '\n';
+        // Empty objects and arrays are printed in a single line, so a line
+        // break after an opening bracket waits for the next token.
+        if (openToken != jsont::End) {
+            auto const close = static_cast<jsont::Token>(
+                    static_cast<uint8_t>(openToken) + uint8_t(1));
+            openToken = jsont::End;
+            if (tok == close) {
+                writeJSON(sint, value);
+                pendingLineBreak = true;
+                return true;
+            }
+            indent++;
+            pendingLineBreak = true;
+        }
+        if (pendingLineBreak) {
+            pendingLineBreak = false;
+            lineBreak(sint, tok);
         }
-    };
-    while (true) {
         switch (tok) {
+        case jsont::NeedMoreInput:    // Handled above
+            return true;
         case jsont::Error:
-            std::cerr << reader.errorMessage() << std::endl;
-            [[fallthrough]];
         case jsont::End:
-            return;
+            return false;
         case jsont::ObjectStart:
-        case jsont::ArrayStart: {
-            printIndentedValue(printValueRaw, false);
-            auto const next = static_cast<jsont::Token>(
-                    static_cast<uint8_t>(tok) + uint8_t(1));
-            tok = reader.next();
-            if (tok == next) {
-                printValueRaw();
-                break;
-            }
-            indent++;
-            lineBreak();
-            continue;
-        }
+        case jsont::ArrayStart:
+            printIndent(sint, false);
+            writeJSON(sint, value);
+            openToken = tok;
+            return true;
         case jsont::ObjectEnd:
         case jsont::ArrayEnd:
             if (indent == 0) {
-                return;
+                return false;
             }
             --indent;
             [[fallthrough]];
@@ -100,20 +150,91 @@ void printJSON(
         case jsont::Integer:
         case jsont::Float:
         case jsont::String:
-            printIndentedValue(printValueRaw, false);
+            printIndent(sint, false);
+            writeJSON(sint, value);
             break;
         case jsont::FieldName:
-            printIndentedValue(printValueObject, true);
-            tok = reader.next();
-            continue;
+            printIndent(sint, true);
+            writeJSON(sint, value);
+            writeJSON(sint, ':');
+            if (pretty != eNO_WHITESPACE) {
+                writeJSON(sint, ' ');
+            }
+            return true;
         case jsont::Comma:
-            sint << ',';
+            writeJSON(sint, ',');
             break;
         }
-        tok = reader.next();
-        lineBreak();
+        pendingLineBreak = true;
+        return true;
+    }
+
+    // Updates the state as if a whole value had just been printed. Together
+    // with a copy of the printer taken before, this allows a value to be
+    // printed somewhere else, such as in another thread.
+    void skipValue() noexcept {
+        needValue        = false;
+        pendingLineBreak = true;
+    }
+
+    // Whether every bracket printed so far was closed.
+    [[nodiscard]] auto balanced() const noexcept -> bool {
+        return indent == 0 && openToken == jsont::End;
+    }
+
+    // Reads and prints tokens from a chunked reader until it needs more
+    // input. Returns false when the printer is done, as print does.
+    template <typename Dst>
+    auto printAvailable(Dst& sint, jsont::Tokenizer& reader) -> bool {
+        for (jsont::Token tok = reader.next(); tok != jsont::NeedMoreInput;
+             tok              = reader.next()) {
+            if (!print(sint, reader)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    template <typename Dst>
+    void printIndent(Dst& sint, bool const newNeedValue) {
+        if (pretty == ePRETTY && (newNeedValue || !needValue)) {
+            for (size_t count = indent; count != 0;) {
+                size_t const run = std::min(count, IndentSlab.size());
+                writeJSON(sint, std::string_view(IndentSlab.data(), run));
+                count -= run;
+            }
+        }
+        needValue = newNeedValue;
+    }
+
+    template <typename Dst>
+    void lineBreak(Dst& sint, jsont::Token const tok) {
+        if (tok != jsont::Comma
+            && (indent == newlineForceIndent || pretty == ePRETTY)) {
+            writeJSON(sint, '\n');
+        }
+    }
+
+    PrettyJSON   pretty;
+    size_t       newlineForceIndent;
+    size_t       indent           = 0;
+    bool         needValue        = false;
+    bool         pendingLineBreak = false;
+    jsont::Token openToken        = jsont::End;
+};
+
+// Prints tokens from the reader until the printer is done; the reader is left
+// at the token that ended printing. The output can be a Json_buffer, which is
+// the fastest, or any ostream.
+template <typename Dst>
+void printJSON(
+        jsont::Tokenizer& reader, Dst& sint, PrettyJSON const pretty,
+        size_t newlineForceIndent) {
+    Json_printer printer(pretty, newlineForceIndent);
+    while (printer.print(sint, reader)) {
+        reader.next();
     }
-    __builtin_unreachable();
 }
 
 template <typename Src, typename Dst>
@@ -122,39 +243,71 @@ void printJSON(Src const& data, Dst& sint, PrettyJSON const pretty) {
     printJSON(reader, sint, pretty, 0U);
 }
 
-// JSON pretty-print filter for boost::filtering_ostream
+// JSON pretty-print filter for boost::filtering_ostream. Input is printed as
+// it arrives, and only a token split between two writes is kept until the
+// next one, so memory use does not depend on the size of the JSON. Whatever
+// follows the end of the printing, such as data after the top-level value, is
+// discarded.
 template <typename Ch, typename Alloc = std::allocator<Ch>>
-class basic_json_filter : public boost::iostreams::aggregate_filter<Ch, Alloc> {
-private:
-    using base_type = boost::iostreams::aggregate_filter<Ch, Alloc>;
-
+class basic_json_filter {
 public:
-    using char_type = typename base_type::char_type;
-    using category  = typename base_type::category;
+    using char_type = Ch;
+    struct category
+            : boost::iostreams::multichar_output_filter_tag,
+              boost::iostreams::closable_tag {};
 
     explicit basic_json_filter(PrettyJSON _pretty, size_t* _length = nullptr)
-            : pretty(_pretty), length(_length) {}
+            : pretty(_pretty), printer(_pretty, 0U), length(_length) {}
 
-private:
-    using vector_type = typename base_type::vector_type;
-    void set_length(size_t value) {
+    template <typename Sink>
+    auto write(Sink& snk, char_type const* src, std::streamsize count)
+            -> std::streamsize {
+        // Once the printer is done, the rest of the input is discarded.
+        if (done) {
+            return count;
+        }
+        reader.feed(std::string_view(src, static_cast<size_t>(count)));
+        printTokens(snk);
+        if (!done) {
+            // Keep what is left of the input, as src is not ours.
+            reader.feed(std::string_view());
+        }
+        return count;
+    }
+
+    template <typename Sink>
+    void close(Sink& snk) {
+        reader.finish();
+        printTokens(snk);
         if (length != nullptr) {
-            *length = value;
+            *length = written;
         }
+        *this = basic_json_filter(pretty, length);
     }
-    void do_filter(vector_type const& src, vector_type& dest) final {
-        if (src.empty()) {
-            set_length(0);
+
+private:
+    // Prints the tokens read so far, and writes the result to the sink.
+    template <typename Sink>
+    void printTokens(Sink& snk) {
+        if (done) {
             return;
         }
-        vectorstream sint(std::ios::in | std::ios::out | std::ios::binary);
-        sint.reserve(src.size() * 3 / 2);
-        printJSON(src, sint, pretty);
-        sint.swap_vector(dest);
-        set_length(dest.size());
+        Json_buffer sint(output);
+        done = !printer.printAvailable(sint, reader);
+        boost::iostreams::write(
+                snk, output.data(),
+                static_cast<std::streamsize>(output.size()));
+        written += output.size();
+        output.clear();
     }
-    PrettyJSON const pretty;
-    size_t*          length;
+
+    PrettyJSON        pretty;
+    Json_printer      printer;
+    jsont::Tokenizer  reader;
+    std::vector<char> output;
+    size_t*           length;
+    size_t            written = 0;
+    bool              done    = false;
 };
 // NOLINTNEXTLINE(modernize-use-trailing-return-type)
 BOOST_IOSTREAMS_PIPABLE(basic_json_filter, 2)
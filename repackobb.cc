@@ -15,33 +15,41 @@
  *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "atomicwrite.hh"
+#include "deflate.hh"
 #include "fileentry.hh"
+#include "inflate.hh"
 #include "jsont.hh"
+#include "manifest.hh"
+#include "obbarchive.hh"
+#include "obbwriter.hh"
+#include "parallel.hh"
 #include "prettyJson.hh"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/interprocess/streams/bufferstream.hpp>
 #include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iostreams/filter/aggregate.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/serialization/vector.hpp>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <memory>
-#include <regex>
-#include <sstream>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -56,14 +64,10 @@ using std::exception;
 using std::flush;
 using std::ios;
 using std::istream;
-using std::numeric_limits;
 using std::ostream;
-using std::regex;
-using std::regex_match;
 using std::streamsize;
 using std::string;
 using std::string_view;
-using std::stringstream;
 using std::tuple;
 using std::unordered_map;
 using std::vector;
@@ -77,8 +81,6 @@ using boost::filesystem::ofstream;
 using boost::filesystem::path;
 using boost::iostreams::aggregate_filter;
 using boost::iostreams::filtering_ostream;
-using boost::iostreams::zlib_compressor;
-namespace zlib = boost::iostreams::zlib;
 
 using ibufferstream = boost::interprocess::basic_ibufferstream<char>;
 
@@ -94,7 +96,7 @@ public:
     using category  = typename base_type::category;
 
     explicit basic_json_unstitch_filter(
-            filtering_ostream& _inkContent, string _inkFileName)
+            vector<char>& _inkContent, string _inkFileName)
             : inkContent(_inkContent), inkFileName(std::move(_inkFileName)) {}
 
 private:
@@ -113,10 +115,9 @@ private:
             printValueObject(sint, reader);
             return;
         }
-        // Temporary storage for stitches, so we can get the offset and length
-        // for the story file.
-        stringstream stitches(ios::in | ios::out | ios::binary);
-        auto         curr_position = stitches.tellp();
+        // Stitches are printed straight to the inkcontent file, minified; the
+        // offset of each is the number of bytes printed before it.
+        Json_buffer stitchSink(inkContent);
         sint << R"("indexed-content":)"sv;
         jsont::Token tok = reader.next();
         assert(tok == jsont::ObjectStart);
@@ -125,9 +126,8 @@ private:
         tok = reader.next();
         while (tok != jsont::ObjectEnd) {
             assert(tok == jsont::FieldName);
-            curr_position = stitches.tellp();
-            printValueObject(sint, reader)
-                    << '"' << uint32_t(curr_position) << ' ';
+            size_t const position = inkContent.size();
+            printValueObject(sint, reader) << '"' << position << ' ';
             tok = reader.next();
             assert(tok == jsont::ObjectStart);
             // Handle "content" arrays seperately.
@@ -136,21 +136,20 @@ private:
                 && reader.dataValue() == R"("content")"sv) {
                 tok = reader.next();
                 assert(tok == jsont::ArrayStart);
-                printJSON(reader, stitches, eNO_WHITESPACE, ~0U);
+                printJSON(reader, stitchSink, eNO_WHITESPACE, ~0U);
                 tok = reader.current();
                 assert(tok == jsont::ObjectEnd);
-                stitches << '\n';
+                writeJSON(stitchSink, '\n');
             } else {
                 // We have an object on the ink file.
                 // Need to print the open curly brace.
-                stitches << '{';
-                printJSON(reader, stitches, eNO_WHITESPACE, ~0U);
+                writeJSON(stitchSink, '{');
+                printJSON(reader, stitchSink, eNO_WHITESPACE, ~0U);
                 tok = reader.current();
                 assert(tok == jsont::ObjectEnd);
-                stitches << "}\n";
+                writeJSON(stitchSink, "}\n"sv);
             }
-            auto end_position = stitches.tellp();
-            sint << uint32_t(end_position - curr_position) << '"';
+            sint << inkContent.size() - position << '"';
             tok = reader.next();
             if (tok == jsont::Comma) {
                 printValueRaw(sint, reader);
@@ -162,9 +161,6 @@ private:
         printValueRaw(sint, reader);
         // This closes the "indexed-content" object.
         printValueRaw(sint, reader);
-        // Write out inkcontent file.
-        stitches.seekg(0);
-        inkContent << stitches.rdbuf();
     }
 
     void do_filter(vector_type const& src, vector_type& dest) final {
@@ -188,8 +184,8 @@ private:
         }
         __builtin_unreachable();
     }
-    filtering_ostream& inkContent;
-    string             inkFileName;
+    vector<char>& inkContent;
+    string        inkFileName;
 };
 // NOLINTNEXTLINE(modernize-use-trailing-return-type)
 BOOST_IOSTREAMS_PIPABLE(basic_json_unstitch_filter, 2)
@@ -206,10 +202,116 @@ enum ErrorCodes {
     eINPUT_NO_ACCESS,
     eINPUT_NO_FILE_TABLE,
     eINPUT_FILES_MISSING,
-    eINPUT_FILES_NOT_VALID
+    eINPUT_FILES_NOT_VALID,
+    eINVALID_ARGS,
+    eBASE_OBB_INVALID,
+    eCOMPRESSION_FAILED,
+    eOBB_TOO_LARGE
 };
 
-[[nodiscard]] auto openObbFile(path const& obbfile) {
+void usage(ostream& out, string_view const program) {
+    out << "Usage: "sv << program
+        << " [-j N] [-b baseobb] [-c [.ext=]profile]... inputdir "
+           "outputfile\n\n"sv
+        << "Where:\n"
+           "\t-j N\tCompresses using N threads; 0 means one per hardware "
+           "thread.\n"
+           "\t\tDefaults to 1.\n"
+           "\t-c\tCompression profile: 'fast', 'default', 'best' or "
+           "'exhaustive'.\n"
+           "\t\tDefaults to 'best'; 'exhaustive' tries every zlib strategy "
+           "and\n"
+           "\t\tkeeps the smallest result. As '.ext=profile', it only "
+           "applies to\n"
+           "\t\tfiles with that extension, such as '.json=fast'.\n"
+           "\t-b\tIncremental mode: files whose contents are unchanged from "
+           "those\n"
+           "\t\tin baseobb (usually, the OBB inputdir was extracted from) "
+           "are\n"
+           "\t\tcopied from it as they are, instead of being compressed "
+           "again.\n"
+           "\t\tIf no file changed, baseobb itself is copied, so the "
+           "output is\n"
+           "\t\tidentical to it.\n\n"sv;
+}
+
+[[nodiscard]] auto parseCompression(
+        string_view const name, Compression& mode) noexcept -> bool {
+    constexpr static const array<std::pair<string_view, Compression>, 4>
+            profiles{
+                    std::pair("fast"sv, eCOMPRESS_FAST),
+                    std::pair("default"sv, eCOMPRESS_DEFAULT),
+                    std::pair("best"sv, eCOMPRESS_BEST),
+                    std::pair("exhaustive"sv, eCOMPRESS_EXHAUSTIVE)};
+    for (auto const& [profileName, profile] : profiles) {
+        if (name == profileName) {
+            mode = profile;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The compression profile for each file: one for all files, with overrides
+// for some extensions.
+class Compression_options {
+public:
+    // Parses "profile" or ".ext=profile".
+    [[nodiscard]] auto parse(string_view const arg) -> bool {
+        size_t const equals = arg.find('=');
+        if (equals == string_view::npos) {
+            return parseCompression(arg, fallback);
+        }
+        string_view const extension = arg.substr(0, equals);
+        if (extension.size() < 2 || extension[0] != '.') {
+            return false;
+        }
+        Compression mode = fallback;
+        if (!parseCompression(arg.substr(equals + 1), mode)) {
+            return false;
+        }
+        byExtension[string(extension)] = mode;
+        return true;
+    }
+
+    [[nodiscard]] auto forFile(path const& fname) const -> Compression {
+        auto const iter = byExtension.find(fname.extension().string());
+        return iter == byExtension.cend() ? fallback : iter->second;
+    }
+
+private:
+    Compression                         fallback = eCOMPRESS_BEST;
+    unordered_map<string, Compression> byExtension;
+};
+
+[[nodiscard]] auto openBaseObbFile(path const& basefile, path const& obbfile)
+        -> std::unique_ptr<ObbArchive> {
+    if (!exists(basefile) || !is_regular_file(basefile)) {
+        cerr << "Base OBB "sv << basefile << " must be an existing file!"sv
+             << endl
+             << endl;
+        throw ErrorCodes{eBASE_OBB_INVALID};
+    }
+    if (exists(obbfile) && equivalent(basefile, obbfile)) {
+        cerr << "Base OBB "sv << basefile
+             << " cannot be the output file!"sv << endl
+             << endl;
+        throw ErrorCodes{eBASE_OBB_INVALID};
+    }
+    try {
+        return std::make_unique<ObbArchive>(basefile);
+    } catch (ObbArchive::Error) {
+        cerr << "Base OBB "sv << basefile << " is not a valid OBB!"sv << endl
+             << endl;
+    } catch (std::ios_base::failure const&) {
+        cerr << "Could not open base OBB "sv << basefile << "!"sv << endl
+             << endl;
+    }
+    throw ErrorCodes{eBASE_OBB_INVALID};
+}
+
+// Makes way for the output file, deleting it if it exists.
+void prepareObbFile(path const& obbfile) {
     if (exists(obbfile)) {
         if (!is_regular_file(obbfile)) {
             cerr << "Path "sv << obbfile
@@ -224,43 +326,82 @@ enum ErrorCodes {
             throw ErrorCodes{eOBB_NO_ACCESS};
         }
     }
+}
 
-    std::unique_ptr fout
-            = std::make_unique<ofstream>(obbfile, ios::out | ios::binary);
-    if (!fout->good()) {
+[[nodiscard]] auto openObbFile(path const& obbfile)
+        -> std::unique_ptr<Obb_writer> {
+    prepareObbFile(obbfile);
+    try {
+        return std::make_unique<Obb_writer>(obbfile);
+    } catch (std::ios_base::failure const&) {
         cerr << "Could not open output file "sv << obbfile << "!"sv << endl
              << endl;
-        throw ErrorCodes{eOBB_NO_ACCESS};
     }
-
-    (*fout) << "AP_Pack!"sv;
-    return fout;
+    throw ErrorCodes{eOBB_NO_ACCESS};
 }
 
+// Checks that an input file exists with a single stat; files that cannot be
+// read are reported when they are read.
 void checkFile(path const& fpath) {
-    if (!exists(fpath)) {
+    boost::system::error_code             err;
+    boost::filesystem::file_status const status
+            = boost::filesystem::status(fpath, err);
+    if (!exists(status)) {
         cerr << "Input file "sv << fpath
              << " does not exist! Please re-dump the OBB."sv << endl
              << endl;
         throw ErrorCodes{eINPUT_FILES_MISSING};
     }
-    if (!is_regular_file(fpath)) {
+    if (!is_regular_file(status)) {
         cerr << "Input "sv << fpath
              << " is not a file! Please re-dump the OBB."sv << endl
              << endl;
         throw ErrorCodes{eINPUT_FILES_NOT_VALID};
     }
-    ifstream fin(fpath, ios::in | ios::binary);
-    if (!fin.good()) {
-        cerr << "Input file "sv << fpath
-             << " is not readable! Please re-dump the OBB."sv << endl
+}
+
+// Reads the list of files to pack. It comes from the manifest saved by
+// xtractobb, or from the FileTable.ser saved by older versions, which has no
+// manifest to check files against.
+[[nodiscard]] auto readFileTable(path const& indir)
+        -> tuple<vector<RFile_entry>, std::optional<Manifest>> {
+    vector<RFile_entry> entries;
+    path const          manifestFile(indir / "FileTable.bin");
+    if (!exists(manifestFile)) {
+        path const filetable(indir / "FileTable.ser");
+        checkFile(filetable);
+        ifstream      file_table(filetable);
+        text_iarchive ia(file_table);
+        ia >> entries;
+        return {std::move(entries), std::nullopt};
+    }
+
+    checkFile(manifestFile);
+    Manifest manifest;
+    try {
+        boost::iostreams::mapped_file_source const source(manifestFile);
+        manifest = Manifest::parse(string_view(source.data(), source.size()));
+    } catch (std::ios_base::failure const&) {
+        cerr << "Could not read file table "sv << manifestFile << "!"sv << endl
              << endl;
         throw ErrorCodes{eINPUT_NO_ACCESS};
+    } catch (Manifest::Error) {
+        cerr << "File table "sv << manifestFile
+             << " is corrupt! Please re-dump the OBB."sv << endl
+             << endl;
+        throw ErrorCodes{eINPUT_NO_FILE_TABLE};
+    }
+    entries.reserve(manifest.entries.size());
+    for (auto const& record : manifest.entries) {
+        RFile_entry& entry = entries.emplace_back();
+        entry.fname        = record.fname;
+        entry.compressed   = record.compressed;
     }
+    return {std::move(entries), std::move(manifest)};
 }
 
-[[nodiscard]] auto readInputDir(path const& indir)
-        -> tuple<vector<RFile_entry>, string, string, string> {
+[[nodiscard]] auto readInputDir(path const& indir) -> tuple<
+        vector<RFile_entry>, std::optional<Manifest>, string, string, string> {
     if (!exists(indir)) {
         cerr << "Input path "sv << indir << " does not exist!"sv << endl
              << endl;
@@ -270,22 +411,7 @@ void checkFile(path const& fpath) {
         cerr << "Path "sv << indir << " must be a directory!"sv << endl << endl;
         throw ErrorCodes{eINPUT_NOT_DIR};
     }
-    // Read file list.
-    path const filetable(indir / "FileTable.ser");
-    checkFile(filetable);
-    vector<RFile_entry> entries;
-    {
-        ifstream      file_table(indir / "FileTable.ser");
-        text_iarchive ia(file_table);
-        ia >> entries;
-    }
-
-    // TODO: Main json file should be found from Info.plist file:
-    //  main json filename = dict["StoryFilename"sv] + ".json"
-    static regex const mainJsonRegex(R"regex(Sorcery\d\.(min)?json)regex"s);
-    // TODO: inkcontent filename should be found from main json:
-    // inkcontent filename = indexed-content/filename
-    static regex const inkContentRegex(R"regex(Sorcery\d\.inkcontent)regex"s);
+    auto [entries, manifest] = readFileTable(indir);
 
     string referenceFileName;
     string mainJsonFileName;
@@ -294,183 +420,508 @@ void checkFile(path const& fpath) {
     for (auto& entry : entries) {
         checkFile(indir / entry.name());
         string_view fname = entry.name();
-        if (regex_match(fname.cbegin(), fname.cend(), mainJsonRegex)) {
+        if (isMainJsonFile(fname)) {
             referenceFileName = fname.substr(0, "SorceryN"sv.size());
             referenceFileName += "-Reference.json"s;
             mainJsonFileName = fname;
             checkFile(indir / referenceFileName);
-        } else if (regex_match(fname.cbegin(), fname.cend(), inkContentRegex)) {
+        } else if (isInkContentFile(fname)) {
             inkContentFileName = fname;
         }
     }
-    return {entries, referenceFileName, mainJsonFileName, inkContentFileName};
+    return {std::move(entries), std::move(manifest), referenceFileName,
+            mainJsonFileName, inkContentFileName};
 }
 
-inline auto roundUp(uint32_t numToRound, uint32_t multiple) -> uint32_t {
-    assert(multiple);
-    return ((numToRound + multiple - 1) / multiple) * multiple;
+using Duration = std::chrono::steady_clock::duration;
+
+// A file from the input directory, ready to be appended to the OBB.
+struct Encoded_file {
+    uint32_t     fulllength = 0U;
+    vector<char> buffer;
+    string_view  contents;    // Either buffer, or a file in the base OBB
+    bool         reused     = false;
+    bool         deflated   = false;    // Compressed by us
+    Duration     deflateTime{};
+
+    Encoded_file() noexcept = default;
+    // Copies a file from the base OBB as it is, for files that are known to
+    // be unchanged since they were extracted from it.
+    explicit Encoded_file(XFile_entry const& baseEntry) noexcept
+            : fulllength(baseEntry.fulllength), contents(baseEntry.file()),
+              reused(true) {}
+};
+
+// Totals over the files compressed in a run, to show what the compression
+// profiles cost and save. The compression time is summed over all threads, so
+// with many threads it can exceed the packing time, which is the wall-clock
+// time taken to read, compress and write all files.
+struct Compression_report {
+    size_t   numFiles   = 0;
+    uint64_t fullBytes  = 0;
+    uint64_t compBytes  = 0;
+    Duration deflateTime{};
+    Duration packTime{};
+
+    void add(Encoded_file const& file) {
+        if (file.deflated) {
+            numFiles++;
+            fullBytes += file.fulllength;
+            compBytes += file.contents.size();
+            deflateTime += file.deflateTime;
+        }
+    }
+
+    void print(ostream& out) const {
+        if (numFiles == 0) {
+            return;
+        }
+        double const ratio
+                = fullBytes == 0 ? 100.0
+                                 : 100.0 * static_cast<double>(compBytes)
+                                           / static_cast<double>(fullBytes);
+        auto const seconds = [](Duration const time) {
+            return std::chrono::duration<double>(time).count();
+        };
+        out << "Compressed "sv << numFiles << " files from "sv << fullBytes
+            << " to "sv << compBytes << " bytes ("sv << std::fixed
+            << std::setprecision(1) << ratio << "%), using "sv
+            << std::setprecision(3) << seconds(deflateTime)
+            << " s of compression summed over all threads; packing took "sv
+            << seconds(packTime) << " s."sv << endl;
+    }
+};
+
+// JSON files are stored minified in the OBB.
+[[nodiscard]] auto isJsonFile(path const& fname) -> bool {
+    return fname.extension() == ".json"s
+           || fname.extension() == ".inkcontent"s;
 }
 
-auto encodeFile(ofstream& obbContents, path const& infile, bool compressed)
-        -> tuple<uint32_t, uint32_t, uint32_t> {
-    path const parentdir(infile.parent_path());
+// Reads a file from the input directory as it is on disk.
+[[nodiscard]] auto readInputFile(path const& infile) -> vector<char> {
     // Sanity check; if someone else is modifying the input directory as we
     // process the files, we should stop.
     assert(exists(infile));
 
-    size_t     fulllength = file_size(infile);
-    bool const isJson     = infile.extension() == ".json"s
-                        || infile.extension() == ".inkcontent"s;
+    ifstream fin(infile, ios::in | ios::binary);
+    if (!fin.good()) {
+        cerr << "\33[2K\rInput file "sv << infile
+             << " is not readable! Please re-dump the OBB."sv << endl
+             << endl;
+        throw ErrorCodes{eINPUT_NO_ACCESS};
+    }
 
-    stringstream sint(ios::in | ios::out | ios::binary);
+    vector<char> result(file_size(infile));
+    fin.read(result.data(), static_cast<streamsize>(result.size()));
+    return result;
+}
 
-    {
-        ifstream fin(infile, ios::in | ios::binary);
-        // Sanity check; if someone else is modifying the input directory as we
-        // process the files, we should stop.
-        assert(fin.good());
-
-        {
-            filtering_ostream fsout;
-            if (isJson) {
-                fsout.push(json_filter(eNO_WHITESPACE, &fulllength));
-            }
-            if (compressed) {
-                fsout.push(zlib_compressor(
-                        zlib::best_compression, 1 * 1024 * 1024));
-            }
-            fsout.push(sint);
-            fsout << fin.rdbuf();
+// Minifies JSON, as it is stored in the OBB.
+template <typename Src>
+[[nodiscard]] auto minifyJson(Src const& json) -> vector<char> {
+    vector<char> result;
+    result.reserve(json.size());
+    Json_buffer sint(result);
+    printJSON(json, sint, eNO_WHITESPACE);
+    return result;
+}
+
+// Whether stored, the contents of a file as they would be stored in the OBB,
+// are those of baseEntry, its counterpart in a base OBB that the input
+// directory was not extracted from. Other tools may format JSON differently,
+// so JSON files in the base OBB are minified the same way to compare them; the
+// size check avoids inflating most other changed files. A corrupt file in the
+// base OBB is just treated as changed.
+[[nodiscard]] auto matchesBase(
+        string_view const stored, bool const isJson, bool const compressed,
+        XFile_entry const& baseEntry) -> bool {
+    if (baseEntry.compressed != compressed
+        || (!isJson && baseEntry.fulllength != stored.size())) {
+        return false;
+    }
+    vector<char> buffer;
+    string_view  base = baseEntry.file();
+    if (compressed) {
+        if (!inflateInto(base, buffer, baseEntry.fulllength)) {
+            return false;
         }
+        base = string_view(buffer.data(), buffer.size());
     }
+    if (!isJson || base == stored) {
+        return base == stored;
+    }
+    vector<char> const minified = minifyJson(base);
+    return string_view(minified.data(), minified.size()) == stored;
+}
 
-    sint.seekg(0);
-    obbContents << sint.rdbuf();
-
-    sint.seekg(0);
-    sint.ignore(numeric_limits<streamsize>::max());
-    uint32_t const complength = sint.gcount();
-
-    uint32_t const padding = roundUp(complength, 16U) - complength;
-    constexpr static const array<char, 16U> nullPadding{};
-    obbContents.write(nullPadding.data(), padding);
+// A story file, as regenerated from the reference file: its contents, minified
+// as they are stored in the OBB, and the hash of the file written for it to
+// the input directory.
+struct Story_file {
+    string       fname;
+    vector<char> contents;
+    uint64_t     hash = 0U;
+};
 
-    return {fulllength, complength, padding};
+// Whether a regenerated story file is unchanged from baseEntry, its
+// counterpart in the base OBB; record is as for readChangedFile.
+[[nodiscard]] auto storyMatchesBase(
+        Story_file const& file, bool const compressed,
+        XFile_entry const* baseEntry, Manifest_entry const* record) -> bool {
+    if (baseEntry == nullptr) {
+        return false;
+    }
+    if (record != nullptr) {
+        return file.hash == record->hash;
+    }
+    return matchesBase(
+            string_view(file.contents.data(), file.contents.size()), true,
+            compressed, *baseEntry);
 }
 
-auto writeJSON(
-        path const& fpath, ofstream& fout, filtering_ostream& fsout,
-        json_unstitch_filter* fsink) {
-    fout.open(fpath, ios::in | ios::binary);
-    if (!fout.good()) {
-        cerr << "Could not create file "sv << fpath << endl << endl;
-        throw ErrorCodes{eINPUT_NO_ACCESS};
+// Reads a file from the input directory, unless it is unchanged from
+// baseEntry, its counterpart in the base OBB. Returns nothing if the file is
+// unchanged, or else its contents as they are to be stored in the OBB. If the
+// input directory was extracted from the base OBB, record is the manifest
+// entry of the file: the file is unchanged if it still has the stamp, or else
+// the hash, of what was extracted, however the base OBB was formatted.
+// Otherwise, the file is compared to the base OBB by matchesBase.
+[[nodiscard]] auto readChangedFile(
+        path const& infile, bool const compressed,
+        XFile_entry const* baseEntry, Manifest_entry const* record)
+        -> std::optional<vector<char>> {
+    bool const extracted = baseEntry != nullptr && record != nullptr;
+    if (extracted && Disk_stamp::of(infile) == record->stamp) {
+        return std::nullopt;
+    }
+    vector<char> input = readInputFile(infile);
+    if (extracted
+        && contentHash(string_view(input.data(), input.size()))
+                   == record->hash) {
+        return std::nullopt;
     }
-    if (fsink != nullptr) {
-        fsout.push(*fsink);
+    bool const   isJson = isJsonFile(infile);
+    vector<char> stored = isJson ? minifyJson(input) : std::move(input);
+    if (baseEntry != nullptr && record == nullptr
+        && matchesBase(
+                string_view(stored.data(), stored.size()), isJson, compressed,
+                *baseEntry)) {
+        return std::nullopt;
+    }
+    return stored;
+}
+
+// Compresses the contents of a file, if needed.
+[[nodiscard]] auto encodeFile(
+        vector<char> contents, bool compressed, Compression mode)
+        -> Encoded_file {
+    Encoded_file result;
+
+    result.fulllength = static_cast<uint32_t>(contents.size());
+    if (compressed) {
+        auto const start = std::chrono::steady_clock::now();
+        if (!deflateInto(
+                    string_view(contents.data(), contents.size()),
+                    result.buffer, mode)) {
+            cerr << "\33[2K\rCould not compress file!"sv << endl << endl;
+            throw ErrorCodes{eCOMPRESSION_FAILED};
+        }
+        result.deflated    = true;
+        result.deflateTime = std::chrono::steady_clock::now() - start;
+    } else {
+        result.buffer = std::move(contents);
     }
-    fsout.push(json_filter(ePRETTY));
-    fsout.push(fout);
+    result.contents = string_view(result.buffer.data(), result.buffer.size());
+    return result;
 }
 
-void unpackReferenceFile(
+// The story files, as regenerated from the reference file.
+struct Regenerated_story {
+    Story_file mainJson;
+    Story_file inkContent;
+
+    // The story file of that name, or nullptr for any other file.
+    [[nodiscard]] auto find(string_view const fname) -> Story_file* {
+        if (fname == mainJson.fname) {
+            return &mainJson;
+        }
+        if (fname == inkContent.fname) {
+            return &inkContent;
+        }
+        return nullptr;
+    }
+};
+
+// Splits the reference file back into the story files. They are printed
+// minified, as they are stored in the OBB; they are also written to the input
+// directory, pretty-printed as xtractobb writes them, so that they match the
+// reference file.
+[[nodiscard]] auto unpackReferenceFile(
         path const& indir, string const& referenceFile,
-        string const& mainJsonFile, string const& inkcontentFile) {
+        string const& mainJsonFile, string const& inkcontentFile)
+        -> Regenerated_story {
     cout << "\33[2K\rRe-generating "sv << inkcontentFile << " and "sv
          << mainJsonFile << " from reference file "sv << referenceFile
          << "... "sv << flush;
-    ofstream          inkfile;
-    filtering_ostream fsinkfile;
-    writeJSON(indir / inkcontentFile, inkfile, fsinkfile, nullptr);
-
-    ofstream             mainfile;
-    filtering_ostream    fsmainfile;
-    json_unstitch_filter filter(fsinkfile, inkcontentFile);
-    writeJSON(indir / mainJsonFile, mainfile, fsmainfile, &filter);
-
-    ifstream reffile(indir / referenceFile, ios::in | ios::binary);
-
-    fsmainfile << reffile.rdbuf();
+    Regenerated_story story{{mainJsonFile, {}, 0U}, {inkcontentFile, {}, 0U}};
+    {
+        ifstream reffile(indir / referenceFile, ios::in | ios::binary);
+        if (!reffile.good()) {
+            cerr << "Could not read reference file "sv << referenceFile
+                 << "!"sv << endl
+                 << endl;
+            throw ErrorCodes{eINPUT_NO_ACCESS};
+        }
+        filtering_ostream fsmainfile;
+        fsmainfile.push(json_unstitch_filter(
+                story.inkContent.contents, inkcontentFile));
+        fsmainfile.push(json_filter(eNO_WHITESPACE));
+        fsmainfile.push(
+                boost::iostreams::back_inserter(story.mainJson.contents));
+        fsmainfile << reffile.rdbuf();
+    }
+    vector<char> pretty;
+    for (Story_file* file : {&story.mainJson, &story.inkContent}) {
+        pretty.clear();
+        pretty.reserve(file->contents.size() * 2);
+        Json_buffer sint(pretty);
+        printJSON(file->contents, sint, ePRETTY);
+        string_view const written(pretty.data(), pretty.size());
+        if (!writeFileAtomic(indir / file->fname, written)) {
+            cerr << "Could not write file "sv << file->fname << "!"sv << endl
+                 << endl;
+            throw ErrorCodes{eINPUT_NO_ACCESS};
+        }
+        file->hash = contentHash(written);
+    }
     cout << "done."sv << flush;
+    return story;
+}
+
+// Whether the input directory holds the same files as the base OBB, with the
+// same contents; if so, the base OBB can be copied as it is, layout and all.
+// If the manifest is given, it must be of the base OBB. Files are compared as
+// by readChangedFile, stopping at the first change.
+[[nodiscard]] auto isUnchanged(
+        path const& indir, vector<RFile_entry> const& entries,
+        Manifest const* manifest, ObbArchive const& baseObb,
+        Regenerated_story* story, unsigned const jobs) -> bool {
+    if (entries.size() != baseObb.size()) {
+        return false;
+    }
+    std::atomic<bool> unchanged{true};
+    parallelFor(
+            entries.size(), jobs,
+            [&indir, &entries, manifest, &baseObb, story, &unchanged]() {
+                return [&indir, &entries, manifest, &baseObb, story,
+                        &unchanged](size_t index) {
+                    if (!unchanged) {
+                        return;
+                    }
+                    RFile_entry const& elem = entries[index];
+                    path const         infile(indir / elem.name());
+                    XFile_entry const* baseEntry = baseObb.find(elem.name());
+                    Manifest_entry const* record
+                            = manifest ? &manifest->entries[index] : nullptr;
+                    Story_file const* storyFile
+                            = story ? story->find(elem.name()) : nullptr;
+                    bool same = false;
+                    if (storyFile != nullptr) {
+                        same = storyMatchesBase(
+                                *storyFile, elem.compressed, baseEntry, record);
+                    } else if (baseEntry != nullptr) {
+                        same = !readChangedFile(
+                                        infile, elem.compressed, baseEntry,
+                                        record)
+                                        .has_value();
+                    }
+                    if (!same) {
+                        unchanged = false;
+                    }
+                };
+            });
+    return unchanged;
 }
 
 extern "C" auto main(int argc, char* argv[]) -> int;
 
 auto main(int argc, char* argv[]) -> int {
     try {
-        if (argc != 3) {
-            cerr << "Usage: "sv << argv[0] << " inputdir outputfile"sv << endl
-                 << endl;
+        string_view const program(argv[0]);
+        unsigned            jobs = 1;
+        path                basefile;
+        Compression_options compression;
+        int                 argi = 1;
+        for (; argi < argc; argi++) {
+            string_view const arg(argv[argi]);
+            if (arg == "-j"sv) {
+                if (++argi == argc || !parseJobCount(argv[argi], jobs)) {
+                    cerr << "Option '-j' requires a numeric argument!"sv
+                         << endl
+                         << endl;
+                    usage(cerr, program);
+                    return eINVALID_ARGS;
+                }
+            } else if (arg == "-b"sv) {
+                if (++argi == argc) {
+                    cerr << "Option '-b' requires a file name!"sv << endl
+                         << endl;
+                    usage(cerr, program);
+                    return eINVALID_ARGS;
+                }
+                basefile = argv[argi];
+            } else if (arg == "-c"sv) {
+                if (++argi == argc || !compression.parse(argv[argi])) {
+                    cerr << "Option '-c' requires a compression profile!"sv
+                         << endl
+                         << endl;
+                    usage(cerr, program);
+                    return eINVALID_ARGS;
+                }
+            } else {
+                break;
+            }
+        }
+        if (argc - argi != 2) {
+            usage(cerr, program);
             return eWRONG_ARGC;
         }
 
-        path const indir(argv[1]);
-        auto [entries, referenceFile, mainJsonFile, inkcontentFile]
+        path const indir(argv[argi]);
+        // Not a structured binding, as lambdas below need to capture entries.
+        vector<RFile_entry>     entries;
+        std::optional<Manifest> manifest;
+        string                  referenceFile;
+        string                  mainJsonFile;
+        string                  inkcontentFile;
+        std::tie(entries, manifest, referenceFile, mainJsonFile, inkcontentFile)
                 = readInputDir(indir);
 
-        path const obbfile(argv[2]);
-        auto       obbptr      = openObbFile(obbfile);
-        auto&      obbcontents = *obbptr;
-
-        uint32_t curr_offset = 8;
-        auto     curr_pos    = obbcontents.tellp();
-        Write4(obbcontents, 0U);    // Placeholder for file size
-        Write4(obbcontents, 0U);    // Placeholder for file table position
-        curr_offset += 8;
-
-        unpackReferenceFile(indir, referenceFile, mainJsonFile, inkcontentFile);
-
-        for (auto& elem : entries) {
-            cout << "\33[2K\rPacking file "sv << elem.name() << flush;
-            path infile(indir / elem.name());
-            auto [file_fulllength, file_complength, file_padding]
-                    = encodeFile(obbcontents, infile, elem.compressed);
-            elem.fdata = {curr_offset, file_fulllength, file_complength};
-            curr_offset += file_complength + file_padding;
+        path const obbfile(argv[argi + 1]);
+        std::unique_ptr<ObbArchive> const baseObb
+                = basefile.empty() ? nullptr
+                                   : openBaseObbFile(basefile, obbfile);
+        // Files that were not changed since they were extracted from the base
+        // OBB can be copied from it without even being read.
+        bool const sameBase
+                = baseObb && manifest
+                  && manifest->obbSize == baseObb->data().size()
+                  && manifest->obbTableHash
+                             == contentHash(baseObb->fileTable());
+        // The story files need only be regenerated if the reference file
+        // was changed since it was extracted.
+        std::optional<Regenerated_story> story;
+        if (!referenceFile.empty() && !inkcontentFile.empty()
+            && (!manifest || manifest->reference == Disk_stamp{}
+                || Disk_stamp::of(indir / referenceFile)
+                           != manifest->reference)) {
+            story = unpackReferenceFile(
+                    indir, referenceFile, mainJsonFile, inkcontentFile);
         }
 
-        cout << endl;
-        cout << "\33[2K\rCreating name table... "sv << flush;
-        unordered_map<string, uint32_t> nameOffsets;
-        for (auto& elem : entries) {
-            string const& fname = elem.fname;
-            nameOffsets[fname]  = curr_offset;
-            curr_offset += fname.size();
-            obbcontents.write(
-                    fname.data(), static_cast<uint32_t>(fname.size()));
+        // Nothing to pack if no file changed since the base OBB.
+        if (baseObb
+            && isUnchanged(
+                    indir, entries, sameBase ? &*manifest : nullptr, *baseObb,
+                    story ? &*story : nullptr, jobs)) {
+            cout << "\33[2K\rNo file changed from base OBB; copying it."sv
+                 << endl;
+            prepareObbFile(obbfile);
+            if (!writeFileAtomic(obbfile, baseObb->data())) {
+                cerr << "Could not write output file "sv << obbfile << "!"sv
+                     << endl
+                     << endl;
+                return eOBB_NO_ACCESS;
+            }
+            return eOK;
         }
-        cout << "done."sv << endl;
 
-        uint32_t const padding = roundUp(curr_offset, 16U) - curr_offset;
-        constexpr static const array<char, 16U> nullPadding{};
-        obbcontents.write(nullPadding.data(), padding);
-        curr_offset += padding;
-
-        // File table is sorted by name.
-        sort(entries.begin(), entries.end(), [](auto& lhs, auto& rhs) {
-            return lhs.name() < rhs.name();
-        });
-
-        cout << "\33[2K\rCreating file table... "sv << flush;
-        uint32_t file_table_pos = curr_offset;
-        for (auto& elem : entries) {
-            string const& fname = elem.fname;
-            Write4(obbcontents, nameOffsets[fname]);
-            Write4(obbcontents, fname.size());
-            File_data const& fdata = elem.fdata;
-            Write4(obbcontents, fdata.offset);
-            Write4(obbcontents, fdata.complength);
-            Write4(obbcontents, fdata.fulllength);
-            curr_offset += 20;
-        }
+        std::unique_ptr<Obb_writer> const obbcontents = openObbFile(obbfile);
+
+        // Files are compressed concurrently; they are then appended to the
+        // OBB in order, as their offsets depend on all files before them.
+        size_t             numReused = 0;
+        Compression_report report;
+        auto const         packStart = std::chrono::steady_clock::now();
+        parallelOrdered(
+                entries.size(), jobs,
+                [&indir, &entries, &baseObb, &manifest, sameBase, &story,
+                 &compression]() {
+                    return [&indir, &entries, &baseObb, &manifest, sameBase,
+                            &story, &compression](size_t index) {
+                        RFile_entry const& elem = entries[index];
+                        path const         infile(indir / elem.name());
+                        Compression const  mode = compression.forFile(infile);
+                        XFile_entry const* baseEntry
+                                = baseObb ? baseObb->find(elem.name())
+                                          : nullptr;
+                        Manifest_entry const* record
+                                = sameBase ? &manifest->entries[index]
+                                           : nullptr;
+                        // Regenerated story files are already in memory.
+                        if (Story_file* storyFile
+                            = story ? story->find(elem.name()) : nullptr) {
+                            if (storyMatchesBase(
+                                        *storyFile, elem.compressed, baseEntry,
+                                        record)) {
+                                return Encoded_file(*baseEntry);
+                            }
+                            return encodeFile(
+                                    std::move(storyFile->contents),
+                                    elem.compressed, mode);
+                        }
+                        // In incremental mode, files that did not change are
+                        // copied from the base OBB as they are.
+                        std::optional<vector<char>> contents = readChangedFile(
+                                infile, elem.compressed, baseEntry, record);
+                        if (!contents) {
+                            return Encoded_file(*baseEntry);
+                        }
+                        return encodeFile(
+                                std::move(*contents), elem.compressed, mode);
+                    };
+                },
+                [&obbcontents, &entries, &numReused,
+                 &report](size_t index, Encoded_file const& file) {
+                    RFile_entry const& elem = entries[index];
+                    cout << "\33[2K\rPacking file "sv << elem.name() << flush;
+                    if (file.reused) {
+                        numReused++;
+                    }
+                    report.add(file);
+                    obbcontents->addFile(
+                            elem.fname, file.contents, file.fulllength,
+                            elem.compressed);
+                });
+        report.packTime = std::chrono::steady_clock::now() - packStart;
 
-        // Fill in the file size and file table offset
-        obbcontents.seekp(curr_pos);
-        Write4(obbcontents, curr_offset);
-        Write4(obbcontents, file_table_pos);
+        cout << endl;
+        if (baseObb) {
+            cout << "Copied "sv << numReused << " of "sv << entries.size()
+                 << " files unchanged from base OBB."sv << endl;
+        }
+        report.print(cout);
+        cout << "\33[2K\rCreating name and file tables... "sv << flush;
+        try {
+            obbcontents->finish();
+        } catch (std::ios_base::failure const&) {
+            cout << endl;
+            cerr << "Could not write output file "sv << obbfile << "!"sv
+                 << endl
+                 << endl;
+            // Do not leave a truncated OBB behind.
+            boost::system::error_code err;
+            remove(obbfile, err);
+            return eOBB_NO_ACCESS;
+        }
         cout << "done."sv << endl;
     } catch (exception const& except) {
         cerr << except.what() << endl;
+    } catch (Obb_writer::Error) {
+        cout << endl;
+        cerr << "Output OBB would be too large!"sv << endl << endl;
+        return eOBB_TOO_LARGE;
     } catch (ErrorCodes err) {
         return err;
     }
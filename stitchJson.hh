@@ -0,0 +1,400 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STITCH_JSON_H
+#define STITCH_JSON_H
+
+#include "jsont.hh"
+#include "parallel.hh"
+#include "prettyJson.hh"
+
+#include <boost/iostreams/filter/aggregate.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Expands the stitches of a Sorcery! story file with their contents from the
+// inkcontent file, optionally printing the result as printJSON would. The story
+// file is read first, with its stitches only recorded. Then the stitches are
+// printed, if asked to, in blocks; and at last, the size of the output being
+// known exactly, everything is copied to its place in it. The last two steps
+// run in parallel with jobs > 1.
+class Stitch_expander {
+public:
+    // Without a PrettyJSON mode, everything is copied as is.
+    Stitch_expander(
+            std::string_view const          _inkContent,
+            std::optional<PrettyJSON> const _pretty, unsigned const _jobs)
+            : inkContent(_inkContent), jobs(_jobs) {
+        if (_pretty) {
+            printer.emplace(*_pretty, 0U);
+        }
+    }
+
+    // Returns false if the story file is not valid JSON, or if it has invalid
+    // ranges for its stitches, or if a printed stitch is not valid JSON; the
+    // output then ends where the problem is, or has the invalid stitch cut
+    // short.
+    template <typename Vector>
+    [[nodiscard]] auto expand(std::string_view const source, Vector& dest)
+            -> bool {
+        framing.reserve(source.size() * 3 / 2);
+        jsont::Tokenizer reader(source);
+        bool             valid = true;
+        for (jsont::Token tok = reader.current(); valid; tok = reader.next()) {
+            if (tok == jsont::FieldName) {
+                valid = handleObjectOrStitch(reader);
+            } else if (tok == jsont::Error || tok == jsont::End) {
+                if (tok == jsont::Error) {
+                    std::cerr << reader.errorMessage() << std::endl;
+                    valid = false;
+                } else if (printer) {
+                    // For the line break at the end.
+                    emit(tok, std::string_view());
+                }
+                break;
+            } else {
+                emit(tok, reader.dataValue());
+            }
+        }
+
+        size_t const numBlocks = (stitches.size() + BlockSize - 1) / BlockSize;
+        if (printer) {
+            printed.resize(numBlocks);
+            errors.resize(numBlocks);
+            parallelFor(numBlocks, jobs, [this]() {
+                return [this](size_t block) {
+                    printBlock(block);
+                };
+            });
+            // Reported here, as the blocks were printed in other threads.
+            for (auto const& error : errors) {
+                if (!error.empty()) {
+                    std::cerr << error << std::endl;
+                    valid = false;
+                }
+            }
+        }
+
+        // Stitches are placed after their framing, and after everything that
+        // comes before it.
+        size_t stitchedSize = 0;
+        for (auto& stitch : stitches) {
+            stitch.position = stitch.framingEnd + stitchedSize;
+            stitchedSize += stitchSize(stitch);
+        }
+        dest.resize(framing.size() + stitchedSize);
+        parallelFor(numBlocks, jobs, [this, &dest]() {
+            return [this, &dest](size_t block) {
+                copyBlock(block, dest.data());
+            };
+        });
+        size_t const framingEnd
+                = stitches.empty() ? 0 : stitches.back().framingEnd;
+        std::copy(
+                framing.data() + framingEnd, framing.data() + framing.size(),
+                dest.data() + (dest.size() - (framing.size() - framingEnd)));
+        return valid;
+    }
+
+private:
+    // Stitches are printed and copied in blocks, to spread the cost of
+    // handing work to threads.
+    constexpr static const size_t           BlockSize = 64;
+    constexpr static const std::string_view WrapPrefix{R"({"content":)"};
+    constexpr static const std::string_view WrapSuffix{"}"};
+
+    // The printed stitch is in [printedBegin, printedEnd) of the output of
+    // its block.
+    struct Stitch {
+        size_t           framingEnd;    // Size of the framing before it
+        std::string_view body;          // Contents, in the inkcontent file
+        bool             wrap;          // True if body is a bare array
+        size_t           printedBegin;
+        size_t           printedEnd;
+        size_t           position;    // Position in the output
+    };
+
+    // Writes a token of the story file, as printed or as is.
+    void emit(jsont::Token const tok, std::string_view const value) {
+        Json_buffer sint(framing);
+        if (printer) {
+            printer->print(sint, tok, value);
+            return;
+        }
+        writeJSON(sint, value);
+        if (tok == jsont::FieldName) {
+            writeJSON(sint, ':');
+        }
+    }
+
+    // Entry of the "ranges" object of a story file: the name of a stitch, and
+    // where its contents are in the inkcontent file.
+    struct Stitch_range {
+        std::string_view name;    // With its quotes
+        uint32_t         offset;
+        uint32_t         length;
+    };
+
+    // Parses a range, '"<offset> <length>"', into range. Returns false unless
+    // it is a non-empty range inside the inkcontent file.
+    [[nodiscard]] auto parseRange(
+            std::string_view value, Stitch_range& range) const noexcept
+            -> bool {
+        auto const skipSpaces = [&value]() {
+            value.remove_prefix(
+                    std::min(value.find_first_not_of(' '), value.size()));
+        };
+        auto const parseNumber = [&value](uint32_t& number) {
+            char const* const end = value.data() + value.size();
+            auto const [ptr, err] = std::from_chars(value.data(), end, number);
+            value.remove_prefix(static_cast<size_t>(ptr - value.data()));
+            return err == std::errc();
+        };
+        if (value.size() < 2 || value.front() != '"' || value.back() != '"') {
+            return false;
+        }
+        value = value.substr(1, value.size() - 2);
+        skipSpaces();
+        if (!parseNumber(range.offset)) {
+            return false;
+        }
+        skipSpaces();
+        if (!parseNumber(range.length)) {
+            return false;
+        }
+        skipSpaces();
+        return value.empty() && range.length != 0
+               && range.offset <= inkContent.size()
+               && range.length <= inkContent.size() - range.offset;
+    }
+
+    // Parses the whole "ranges" object, starting at its opening bracket, into
+    // the range table. Returns false if it is not an object of valid ranges;
+    // otherwise, the reader is left at its closing bracket.
+    [[nodiscard]] auto parseRanges(jsont::Tokenizer& reader) -> bool {
+        ranges.clear();
+        if (reader.current() != jsont::ObjectStart) {
+            return false;
+        }
+        for (jsont::Token tok = reader.next(); tok != jsont::ObjectEnd;) {
+            if (tok != jsont::FieldName) {
+                return false;
+            }
+            Stitch_range range{reader.dataValue(), 0U, 0U};
+            if (reader.next() != jsont::String
+                || !parseRange(reader.dataValue(), range)) {
+                std::cerr << "Invalid range for stitch " << range.name << "!"
+                          << std::endl;
+                return false;
+            }
+            ranges.push_back(range);
+            tok = reader.next();
+            if (tok == jsont::Comma) {
+                tok = reader.next();
+            }
+        }
+        return true;
+    }
+
+    // Records a stitch to be placed at the current end of the framing.
+    void addStitch(std::string_view const body) {
+        bool const wrap = body.front() == '[';
+        stitches.push_back(Stitch{framing.size(), body, wrap, 0U, 0U, 0U});
+        if (printer) {
+            printers.push_back(*printer);
+            printer->skipValue();
+        }
+    }
+
+    [[nodiscard]] auto handleObjectOrStitch(jsont::Tokenizer& reader)
+            -> bool {
+        if (reader.dataValue() != R"("indexed-content")") {
+            emit(jsont::FieldName, reader.dataValue());
+            return true;
+        }
+        emit(jsont::FieldName, R"("stitches")");
+        jsont::Token tok = reader.next();
+        assert(tok == jsont::ObjectStart);
+        emit(tok, reader.dataValue());
+        tok = reader.next();
+        while (tok != jsont::ObjectEnd) {
+            assert(tok == jsont::FieldName);
+            if (reader.dataValue() == R"("filename")") {
+                // TODO: instead of being discarded, this should be used with
+                // output directoty to open stitch source file
+                tok = reader.next();    // Fetch filename...
+                assert(tok == jsont::String);
+                tok = reader.next();    // ... and discard it
+                assert(tok == jsont::Comma);
+                tok = reader.next();    // Discard comma after it as well
+            } else if (reader.dataValue() == R"("ranges")") {
+                // The meat.
+                reader.next();
+                if (!parseRanges(reader)) {
+                    return false;
+                }
+                for (size_t ii = 0; ii < ranges.size(); ii++) {
+                    if (ii != 0) {
+                        emit(jsont::Comma, ",");
+                    }
+                    Stitch_range const& range = ranges[ii];
+                    emit(jsont::FieldName, range.name);
+                    addStitch(inkContent.substr(range.offset, range.length));
+                }
+                tok = reader.next();
+            }
+        }
+        assert(tok == jsont::ObjectEnd);
+        emit(tok, reader.dataValue());
+        return true;
+    }
+
+    // Prints the stitches of a block with the printer state from before each.
+    // The first error in the block, if any, is kept in the error list.
+    void printBlock(size_t const block) {
+        std::vector<char>& output = printed[block];
+        Json_buffer        sint(output);
+        jsont::Tokenizer   reader;
+        size_t const       last
+                = std::min(stitches.size(), (block + 1) * BlockSize);
+        size_t bodySize = 0;
+        for (size_t ii = block * BlockSize; ii < last; ii++) {
+            bodySize += stitches[ii].body.size();
+        }
+        output.reserve(bodySize + bodySize / 2);
+        for (size_t ii = block * BlockSize; ii < last; ii++) {
+            Stitch&       stitch      = stitches[ii];
+            Json_printer& thisPrinter = printers[ii];
+            stitch.printedBegin       = output.size();
+            if (stitch.wrap) {
+                thisPrinter.print(sint, jsont::ObjectStart, "{");
+                thisPrinter.print(sint, jsont::FieldName, R"("content")");
+            }
+            reader.reset(stitch.body);
+            jsont::Token tok = reader.current();
+            for (; tok != jsont::End && tok != jsont::Error;
+                 tok = reader.next()) {
+                thisPrinter.print(sint, reader);
+            }
+            if (tok == jsont::Error && errors[block].empty()) {
+                errors[block] = reader.errorMessage();
+            }
+            if (stitch.wrap) {
+                thisPrinter.print(sint, jsont::ObjectEnd, "}");
+            }
+            stitch.printedEnd = output.size();
+        }
+    }
+
+    [[nodiscard]] auto stitchSize(Stitch const& stitch) const noexcept
+            -> size_t {
+        if (printer) {
+            return stitch.printedEnd - stitch.printedBegin;
+        }
+        return stitch.body.size()
+               + (stitch.wrap ? WrapPrefix.size() + WrapSuffix.size() : 0U);
+    }
+
+    // Copies the stitches of a block, each with the framing before it.
+    template <typename Ch>
+    void copyBlock(size_t const block, Ch* const dest) const {
+        size_t const last = std::min(stitches.size(), (block + 1) * BlockSize);
+        for (size_t ii = block * BlockSize; ii < last; ii++) {
+            Stitch const& stitch = stitches[ii];
+            size_t const  framingBegin
+                    = ii == 0 ? 0 : stitches[ii - 1].framingEnd;
+            size_t const  framingSize = stitch.framingEnd - framingBegin;
+            // The framing goes right before the stitch.
+            Ch* out = std::copy(
+                    framing.data() + framingBegin,
+                    framing.data() + stitch.framingEnd,
+                    dest + (stitch.position - framingSize));
+            if (printer) {
+                std::vector<char> const& output = printed[block];
+                std::copy(
+                        output.data() + stitch.printedBegin,
+                        output.data() + stitch.printedEnd, out);
+            } else if (stitch.wrap) {
+                out = std::copy(WrapPrefix.cbegin(), WrapPrefix.cend(), out);
+                out = std::copy(stitch.body.cbegin(), stitch.body.cend(), out);
+                std::copy(WrapSuffix.cbegin(), WrapSuffix.cend(), out);
+            } else {
+                std::copy(stitch.body.cbegin(), stitch.body.cend(), out);
+            }
+        }
+    }
+
+    std::string_view               inkContent;
+    unsigned                       jobs;
+    std::optional<Json_printer>    printer;
+    std::vector<char>              framing;
+    std::vector<Stitch>            stitches;
+    std::vector<Stitch_range>      ranges;
+    std::vector<Json_printer>      printers;    // State before each stitch
+    std::vector<std::vector<char>> printed;     // Printed stitches, by block
+    std::vector<std::string_view>  errors;      // First error, by block
+};
+
+// Sorcery! JSON stitch filter for boost::filtering_ostream. Stitches are copied
+// as they are, or printed, with up to jobs threads.
+template <typename Ch, typename Alloc = std::allocator<Ch>>
+class basic_json_stitch_filter
+        : public boost::iostreams::aggregate_filter<Ch, Alloc> {
+private:
+    using base_type   = boost::iostreams::aggregate_filter<Ch, Alloc>;
+    using vector_type = typename base_type::vector_type;
+
+public:
+    using char_type = typename base_type::char_type;
+    using category  = typename base_type::category;
+
+    // TODO: Filter should receive output directory instead.
+    explicit basic_json_stitch_filter(
+            std::string_view const _inkContent, unsigned const _jobs = 1)
+            : inkContent(_inkContent), jobs(_jobs) {}
+    basic_json_stitch_filter(
+            std::string_view const _inkContent, PrettyJSON const _pretty,
+            unsigned const _jobs = 1)
+            : inkContent(_inkContent), pretty(_pretty), jobs(_jobs) {}
+
+private:
+    void do_filter(vector_type const& src, vector_type& dest) final {
+        // Errors have already been reported, and the output is cut short.
+        Stitch_expander expander(inkContent, pretty, jobs);
+        static_cast<void>(expander.expand(
+                std::string_view(src.data(), src.size()), dest));
+    }
+
+    std::string_view          inkContent;
+    std::optional<PrettyJSON> pretty;
+    unsigned                  jobs;
+};
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+BOOST_IOSTREAMS_PIPABLE(basic_json_stitch_filter, 2)
+
+using json_stitch_filter  = basic_json_stitch_filter<char>;
+using wjson_stitch_filter = basic_json_stitch_filter<wchar_t>;
+
+#endif    // STITCH_JSON_H
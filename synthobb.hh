@@ -0,0 +1,288 @@
+/*
+ *	Copyright © 2020 Flamewing <flamewing.sonic@gmail.com>
+ *
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTHOBB_HH
+#define SYNTHOBB_HH
+
+#include "deflate.hh"
+#include "obbwriter.hh"
+
+#include <boost/filesystem.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Deterministic generator of Sorcery!-like story files. The same seed always
+// gives the same corpus, on every platform, so that results can be compared
+// across runs and builds.
+class Corpus_generator {
+public:
+    explicit Corpus_generator(uint64_t seed) noexcept : state(seed) {}
+
+    [[nodiscard]] auto below(uint32_t bound) noexcept -> uint32_t {
+        return next() % bound;
+    }
+
+    // Size in [minSize, maxSize], distributed so that there are many more
+    // small files than big ones, as in the real OBBs.
+    [[nodiscard]] auto logUniform(uint32_t minSize, uint32_t maxSize) noexcept
+            -> uint32_t {
+        double const fraction
+                = next() / static_cast<double>(
+                          std::numeric_limits<uint32_t>::max());
+        double const scale = std::log(
+                static_cast<double>(maxSize) / std::max(minSize, 1U));
+        auto const size = static_cast<uint32_t>(
+                std::max(minSize, 1U) * std::exp(fraction * scale));
+        return std::clamp(size, minSize, maxSize);
+    }
+
+    void appendSentence(std::string& out) {
+        constexpr static const std::array<std::string_view, 24> words{
+                "the",    "a",       "you",       "sword",
+                "gate",   "Kharé",   "manticore", "walk",
+                "slowly", "towards", "shadow",    "gold",
+                "spell",  "ZAP",     "of",        "and",
+                "north",  "guard",   "whispers",  "stone",
+                "cold",   "lantern", "Analander", "door"};
+        uint32_t const count = 3 + below(14);
+        for (uint32_t ii = 0; ii < count; ii++) {
+            if (ii != 0) {
+                out += ' ';
+            }
+            bool const quoted = below(20) == 0;
+            if (quoted) {
+                out += R"(\")";
+            }
+            out += words[below(words.size())];
+            if (quoted) {
+                out += R"(\")";
+            }
+        }
+        out += below(4) == 0 ? '?' : '.';
+    }
+
+    void appendInkValue(std::string& out, unsigned const depth) {
+        switch (below(depth < 2 ? 11 : 9)) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+            out += R"("^)";
+            appendSentence(out);
+            out += '"';
+            break;
+        case 4:
+            out += R"("\n")";
+            break;
+        case 5:
+            out += std::to_string(below(1000));
+            break;
+        case 6:
+            out += std::to_string(below(100));
+            out += '.';
+            out += std::to_string(below(100));
+            break;
+        case 7: {
+            constexpr static const std::array<std::string_view, 6> atoms{
+                    "true", "false", "null", R"("ev")", R"("/ev")",
+                    R"("done")"};
+            out += atoms[below(atoms.size())];
+            break;
+        }
+        case 8:
+            out += below(2) == 0 ? R"({"->":"stitch)" : R"({"VAR?":"var)";
+            out += std::to_string(below(5000));
+            out += R"("})";
+            break;
+        case 9:
+            out += R"({"*":"c-)";
+            out += std::to_string(below(10));
+            out += R"(","flg":)";
+            out += std::to_string(below(32));
+            out += '}';
+            break;
+        default:
+            appendInkArray(out, depth + 1);
+            break;
+        }
+    }
+
+    void appendInkArray(std::string& out, unsigned const depth) {
+        out += '[';
+        uint32_t const count = 2 + below(18);
+        for (uint32_t ii = 0; ii < count; ii++) {
+            if (ii != 0) {
+                out += ',';
+            }
+            appendInkValue(out, depth);
+        }
+        out += ']';
+    }
+
+    // Appends one stitch the way it is stored in an inkcontent file. Most
+    // stitches are only a content array; the others are whole objects, which
+    // never start with the content array.
+    void appendStitch(std::string& out) {
+        if (below(5) != 0) {
+            appendInkArray(out, 0);
+        } else {
+            out += R"({"flags":)";
+            out += std::to_string(below(8));
+            out += R"(,"content":)";
+            appendInkArray(out, 0);
+            out += '}';
+        }
+        out += '\n';
+    }
+
+    // Minified JSON array of about the given size.
+    [[nodiscard]] auto makeJsonFile(uint32_t const size) -> std::string {
+        std::string out("[");
+        while (out.size() + 1 < size) {
+            if (out.size() > 1) {
+                out += ',';
+            }
+            appendInkArray(out, 0);
+        }
+        out += ']';
+        return out;
+    }
+
+    // Incompressible data of the given size, like the images and sounds in
+    // the real OBBs.
+    [[nodiscard]] auto makeBinaryFile(uint32_t const size) -> std::string {
+        std::string out(size, '\0');
+        for (auto& chr : out) {
+            chr = static_cast<char>(next() >> 24U);
+        }
+        return out;
+    }
+
+private:
+    auto next() noexcept -> uint32_t {
+        // Knuth's MMIX linear congruential generator.
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 32U);
+    }
+
+    uint64_t state;
+};
+
+// Story files, as stored in the OBB: a minified main JSON file, which indexes
+// into an inkcontent file.
+struct Story_corpus {
+    std::string mainJson;
+    std::string inkContent;
+};
+
+[[nodiscard]] inline auto makeStoryCorpus(
+        Corpus_generator& gen, std::string_view const inkFileName,
+        unsigned const numStitches) -> Story_corpus {
+    Story_corpus story;
+    std::string  ranges;
+    for (unsigned ii = 0; ii < numStitches; ii++) {
+        size_t const offset = story.inkContent.size();
+        gen.appendStitch(story.inkContent);
+        if (ii != 0) {
+            ranges += ',';
+        }
+        ranges += R"("stitch)";
+        ranges += std::to_string(ii);
+        ranges += R"(":")";
+        ranges += std::to_string(offset);
+        ranges += ' ';
+        ranges += std::to_string(story.inkContent.size() - offset);
+        ranges += '"';
+    }
+    story.mainJson = R"({"inkVersion":17,"root":)";
+    gen.appendInkArray(story.mainJson, 0);
+    story.mainJson += R"(,"indexed-content":{"filename":")";
+    story.mainJson += inkFileName;
+    story.mainJson += R"(","ranges":{)";
+    story.mainJson += ranges;
+    story.mainJson += R"(}},"listDefs":{}})";
+    return story;
+}
+
+struct Synthetic_obb_options {
+    uint64_t seed        = 0x5eed5eedU;
+    unsigned part        = 1;        // N in SorceryN.json
+    unsigned numStitches = 20000;    // Zero to leave the story files out
+    unsigned numFiles    = 64;       // Files other than the story files
+    uint32_t minSize     = 1024;
+    uint32_t maxSize     = 256 * 1024;
+    unsigned compressedPercent = 50;    // Compressed files are JSON
+    int      level             = Z_BEST_COMPRESSION;
+};
+
+// Writes a synthetic OBB made from the given options. As in the real OBBs,
+// the main story file is compressed, and the inkcontent file is not. Returns
+// the total uncompressed size of the files in it.
+inline auto writeSyntheticObb(
+        boost::filesystem::path const& obbfile,
+        Synthetic_obb_options const&   options) -> size_t {
+    Corpus_generator  gen(options.seed);
+    Obb_writer        writer(obbfile);
+    std::vector<char> buffer;
+    size_t            total   = 0;
+    auto const        addFile = [&writer, &buffer, &options](
+                                 std::string name,
+                                 std::string_view const contents,
+                                 bool const compressed) {
+        std::string_view data = contents;
+        if (compressed) {
+            if (!deflateInto(contents, buffer, options.level)) {
+                throw std::runtime_error("could not compress " + name);
+            }
+            data = std::string_view(buffer.data(), buffer.size());
+        }
+        writer.addFile(std::move(name), data, contents.size(), compressed);
+    };
+    if (options.numStitches != 0) {
+        std::string const storyName = "Sorcery" + std::to_string(options.part);
+        std::string const inkName   = storyName + ".inkcontent";
+        Story_corpus const story
+                = makeStoryCorpus(gen, inkName, options.numStitches);
+        addFile(storyName + ".json", story.mainJson, true);
+        addFile(inkName, story.inkContent, false);
+        total += story.mainJson.size() + story.inkContent.size();
+    }
+    for (unsigned ii = 0; ii < options.numFiles; ii++) {
+        uint32_t const size = gen.logUniform(options.minSize, options.maxSize);
+        bool const compressed = gen.below(100) < options.compressedPercent;
+        std::string const contents = compressed ? gen.makeJsonFile(size)
+                                                : gen.makeBinaryFile(size);
+        std::string const name = (compressed ? "text/strings" : "art/image")
+                                 + std::to_string(ii)
+                                 + (compressed ? ".json" : ".png");
+        addFile(name, contents, compressed);
+        total += contents.size();
+    }
+    writer.finish();
+    return total;
+}
+
+#endif
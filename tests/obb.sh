@@ -0,0 +1,67 @@
+#!/bin/bash
+# Tests xtractobb and repackobb on synthetic OBBs made by genobb. Run it from
+# the top directory, once these three tools are built.
+out=tests/obb
+rm -rf "$out"
+mkdir -p "$out"
+failures=0
+
+fail() {
+	echo "Test failed: $1"
+	failures=$((failures + 1))
+}
+
+# Overwrites a few bytes of the main story file, which genobb always writes
+# first and compressed, so that it no longer inflates.
+corrupt() {
+	printf 'XXXX' | dd of="$1" bs=1 seek=64 conv=notrunc 2> /dev/null
+}
+
+./genobb "$out/orig.obb" > /dev/null
+./xtractobb "$out/orig.obb" "$out/orig" > /dev/null || fail "extracting a synthetic OBB"
+
+# With no edits, repacking against the original OBB gives it back, even if
+# every file was touched.
+./repackobb -b "$out/orig.obb" "$out/orig" "$out/same.obb" > /dev/null
+cmp -s "$out/orig.obb" "$out/same.obb" || fail "repacking an unedited directory"
+find "$out/orig" -type f -exec touch {} +
+./repackobb -b "$out/orig.obb" "$out/orig" "$out/touched.obb" > /dev/null
+cmp -s "$out/orig.obb" "$out/touched.obb" || fail "repacking a touched directory"
+
+# An edited file makes a new OBB, which must verify and extract the edit. The
+# edit is pretty-printed, as xtractobb writes it back.
+./xtractobb "$out/orig.obb" "$out/edit" > /dev/null
+edited=$(cd "$out/edit" && ls text/*.json | head -n 1)
+printf '[\n\t0\n]\n' > "$out/edit/$edited"
+./repackobb -b "$out/orig.obb" "$out/edit" "$out/edit.obb" > /dev/null
+if ! ./xtractobb -v "$out/edit.obb" > /dev/null; then
+	fail "verifying an OBB with an edited file"
+elif cmp -s "$out/orig.obb" "$out/edit.obb"; then
+	fail "repacking an edited file"
+else
+	./xtractobb "$out/edit.obb" "$out/edited" > /dev/null
+	diff -r -x FileTable.bin "$out/edit" "$out/edited" > /dev/null || fail "extracting an edited file"
+fi
+
+# Verifying a corrupt OBB fails.
+cp "$out/orig.obb" "$out/corrupt.obb"
+corrupt "$out/corrupt.obb"
+./xtractobb -v "$out/orig.obb" > /dev/null || fail "verifying a synthetic OBB"
+./xtractobb -v "$out/corrupt.obb" > /dev/null 2>&1 && fail "verifying a corrupt OBB"
+
+# A corrupt file in the base OBB is treated as changed. Packing with another
+# profile makes a base OBB the directory was not extracted from, so that its
+# files are inflated to be compared.
+./repackobb -c fast "$out/orig" "$out/fast.obb" > /dev/null
+corrupt "$out/fast.obb"
+if ! ./repackobb -b "$out/fast.obb" "$out/orig" "$out/unbroken.obb" > /dev/null; then
+	fail "repacking against a corrupt base OBB"
+elif ! ./xtractobb -v "$out/unbroken.obb" > /dev/null; then
+	fail "verifying an OBB repacked against a corrupt base OBB"
+fi
+
+if [ $failures -ne 0 ]; then
+	echo "$failures OBB tests failed"
+	exit 1
+fi
+echo "OBB tests passed"
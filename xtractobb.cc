@@ -15,9 +15,15 @@
  *	along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "atomicwrite.hh"
 #include "fileentry.hh"
+#include "inflate.hh"
 #include "jsont.hh"
+#include "manifest.hh"
+#include "obbarchive.hh"
+#include "parallel.hh"
 #include "prettyJson.hh"
+#include "stitchJson.hh"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -27,25 +33,23 @@
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iostreams/filter/aggregate.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/stream.hpp>
-#include <boost/serialization/vector.hpp>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstdio>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <memory>
-#include <regex>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <vector>
 
-using std::allocator;
 using std::cerr;
 using std::cout;
 using std::endl;
@@ -53,9 +57,10 @@ using std::exception;
 using std::flush;
 using std::ios;
 using std::istream;
+using std::lock_guard;
+using std::mutex;
 using std::ostream;
-using std::regex;
-using std::regex_match;
+using std::streamsize;
 using std::string;
 using std::string_view;
 using std::vector;
@@ -63,132 +68,9 @@ using std::vector;
 using namespace std::literals::string_literals;
 using namespace std::literals::string_view_literals;
 
-using boost::archive::text_oarchive;
 using boost::filesystem::ifstream;
 using boost::filesystem::ofstream;
 using boost::filesystem::path;
-using boost::iostreams::aggregate_filter;
-using boost::iostreams::filtering_ostream;
-using boost::iostreams::mapped_file_source;
-using boost::iostreams::zlib_decompressor;
-namespace zlib = boost::iostreams::zlib;
-
-using ibufferstream = boost::interprocess::basic_ibufferstream<char>;
-
-// Sorcery! JSON stitch filter for boost::filtering_ostream
-template <typename Ch, typename Alloc = allocator<Ch>>
-class basic_json_stitch_filter : public aggregate_filter<Ch, Alloc> {
-private:
-    using base_type   = aggregate_filter<Ch, Alloc>;
-    using vector_type = typename base_type::vector_type;
-
-public:
-    using char_type = typename base_type::char_type;
-    using category  = typename base_type::category;
-
-    // TODO: Filter should receive output directory instead.
-    explicit basic_json_stitch_filter(string_view const _inkContent)
-            : inkContent(_inkContent) {}
-
-private:
-    auto printValueRaw(vectorstream& sint, jsont::Tokenizer& reader)
-            -> decltype(auto) {
-        return sint << reader.dataValue();
-    }
-
-    auto printValueObject(vectorstream& sint, jsont::Tokenizer& reader)
-            -> decltype(auto) {
-        return sint << reader.dataValue() << ':';
-    }
-
-    void handleObjectOrStitch(vectorstream& sint, jsont::Tokenizer& reader) {
-        if (reader.dataValue() != R"("indexed-content")"sv) {
-            printValueObject(sint, reader);
-            return;
-        }
-        sint << R"("stitches":)"sv;
-        jsont::Token tok = reader.next();
-        assert(tok == jsont::ObjectStart);
-        printValueRaw(sint, reader);
-        tok = reader.next();
-        while (tok != jsont::ObjectEnd) {
-            assert(tok == jsont::FieldName);
-            if (reader.dataValue() == R"("filename")"sv) {
-                // TODO: instead of being discarded, this should be used with
-                // output directoty to open stitch source file
-                tok = reader.next();    // Fetch filename...
-                assert(tok == jsont::String);
-                tok = reader.next();    // ... and discard it
-                assert(tok == jsont::Comma);
-                tok = reader.next();    // Discard comma after it as well
-            } else if (reader.dataValue() == R"("ranges")"sv) {
-                // The meat.
-                tok = reader.next();
-                assert(tok == jsont::ObjectStart);
-                tok = reader.next();
-                while (tok != jsont::ObjectEnd) {
-                    assert(tok == jsont::FieldName);
-                    printValueObject(sint, reader);
-                    tok = reader.next();
-                    assert(tok == jsont::String);
-                    string_view slice = reader.dataValue();
-                    // Remove starting double-quotes
-                    slice.remove_prefix(1);
-                    ibufferstream sptr(
-                            slice.data(), slice.length(),
-                            ios::in | ios::binary);
-                    unsigned offset = 0;
-                    unsigned length = 0;
-                    sptr >> offset >> length;
-                    string_view stitch(inkContent.substr(offset, length));
-
-                    if (stitch[0] == '[') {
-                        sint << R"({"content":)"sv << stitch << '}';
-                    } else {
-                        sint << stitch;
-                    }
-                    tok = reader.next();
-                    if (tok == jsont::Comma) {
-                        printValueRaw(sint, reader);
-                        tok = reader.next();
-                    }
-                }
-                assert(tok == jsont::ObjectEnd);
-                tok = reader.next();
-            }
-        }
-        assert(tok == jsont::ObjectEnd);
-        printValueRaw(sint, reader);
-    }
-
-    void do_filter(vector_type const& src, vector_type& dest) final {
-        vectorstream sint(ios::in | ios::out | ios::binary);
-        sint.reserve(src.size() * 3 / 2);
-        jsont::Tokenizer reader(src.data(), src.size());
-        jsont::Token     tok = reader.current();
-        while (true) {
-            if (tok == jsont::FieldName) {
-                handleObjectOrStitch(sint, reader);
-            } else if (tok == jsont::Error || tok == jsont::End) {
-                if (tok == jsont::Error) {
-                    cerr << reader.errorMessage() << endl;
-                }
-                sint.swap_vector(dest);
-                return;
-            } else {
-                printValueRaw(sint, reader);
-            }
-            tok = reader.next();
-        }
-        __builtin_unreachable();
-    }
-    string_view const inkContent;
-};
-// NOLINTNEXTLINE(modernize-use-trailing-return-type)
-BOOST_IOSTREAMS_PIPABLE(basic_json_stitch_filter, 2)
-
-using json_stitch_filter  = basic_json_stitch_filter<char>;
-using wjson_stitch_filter = basic_json_stitch_filter<wchar_t>;
 
 enum ErrorCodes {
     eOK,
@@ -199,10 +81,12 @@ enum ErrorCodes {
     eOBB_INVALID,
     eOBB_CORRUPT,
     eOUTPUT_NOT_DIR,
-    eOUTPUT_NO_ACCESS
+    eOUTPUT_NO_ACCESS,
+    eINVALID_ARGS,
+    eENTRY_NOT_FOUND
 };
 
-[[nodiscard]] auto readObbFile(path const& obbfile) -> mapped_file_source {
+[[nodiscard]] auto readObbFile(path const& obbfile) -> ObbArchive {
     if (!exists(obbfile)) {
         cerr << "File "sv << obbfile << " does not exist!"sv << endl << endl;
         throw ErrorCodes{eOBB_NOT_FOUND};
@@ -212,19 +96,26 @@ enum ErrorCodes {
         throw ErrorCodes{eOBB_NOT_FILE};
     }
 
-    mapped_file_source fin(obbfile);
-    if (!fin.is_open()) {
+    try {
+        return ObbArchive(obbfile);
+    } catch (std::ios_base::failure const&) {
         cerr << "Could not open input file "sv << obbfile << "!"sv << endl
              << endl;
         throw ErrorCodes{eOBB_NO_ACCESS};
+    } catch (ObbArchive::Error err) {
+        switch (err) {
+        case ObbArchive::eNO_SIGNATURE:
+            cerr << "Input file missing signature!"sv << endl << endl;
+            throw ErrorCodes{eOBB_INVALID};
+        case ObbArchive::eBAD_LENGTH:
+            cerr << "Incorrect length in header!"sv << endl << endl;
+            break;
+        default:
+            cerr << "Input file has a corrupt file table!"sv << endl << endl;
+            break;
+        }
+        throw ErrorCodes{eOBB_CORRUPT};
     }
-
-    string_view const oggview(fin.data(), fin.size());
-    if (oggview.substr(0, 8) != "AP_Pack!"sv) {
-        cerr << "Input file missing signature!"sv << endl << endl;
-        throw ErrorCodes{eOBB_INVALID};
-    }
-    return fin;
 }
 
 void createOutputDir(path const& outdir) {
@@ -245,133 +136,468 @@ void createOutputDir(path const& outdir) {
     }
 }
 
-void decodeFile(
-        zlib_decompressor& unzip, path outfile, string_view fdata,
-        string_view inkData, bool compressed, bool isReference) {
+// Serializes console output from the extraction threads.
+static mutex consoleMutex;
+
+void usage(ostream& out, string_view const program) {
+    out << "Usage: "sv << program
+        << " [-j N] [-s MODE] inputfile outputdir [entry...]\n"sv
+        << "Usage: "sv << program << " [-j N] -v inputfile\n\n"sv
+        << "Where:\n"
+           "\t-j N\tExtracts using N threads; 0 means one per hardware "
+           "thread.\n"
+           "\t\tDefaults to 1.\n"
+           "\t-v\tVerifies the OBB instead of extracting it: checks that "
+           "the\n"
+           "\t\tdata of every file is aligned, in bounds and not "
+           "overlapping\n"
+           "\t\tany other, that the file table is sorted, and that every\n"
+           "\t\tcompressed file inflates to its listed size.\n"
+           "\t-s MODE\tSyncs the extracted files to storage. With 'each', "
+           "every\n"
+           "\t\tfile and its directory are synced as it is written; with\n"
+           "\t\t'batch', every file is synced, but each directory only "
+           "once,\n"
+           "\t\tat the end. Files are always written to a temporary file "
+           "that\n"
+           "\t\treplaces the output once complete, so interrupted "
+           "extractions\n"
+           "\t\tnever leave truncated files behind. Defaults to no "
+           "syncing.\n"
+           "\tentry\tName of a file in the OBB to extract; '*' and '?' "
+           "work as\n"
+           "\t\tin shell patterns, but '*' also matches '/'. The reference "
+           "file\n"
+           "\t\tcan be selected as SorceryN-Reference.json. If no entries "
+           "are\n"
+           "\t\tgiven, the whole OBB is extracted, and the file table is "
+           "saved\n"
+           "\t\tfor repackobb.\n\n"sv;
+}
+
+// Matches a name against a shell-like pattern, where '*' matches any sequence
+// of characters and '?' matches any single character.
+[[nodiscard]] __attribute__((pure)) auto globMatch(
+        string_view const pattern, string_view const name) -> bool {
+    size_t pat = 0;
+    size_t str = 0;
+    // Position of the last '*' seen, and of the name character it is
+    // currently matched up to, for backtracking.
+    size_t starPat = string_view::npos;
+    size_t starStr = 0;
+    while (str < name.size()) {
+        if (pat < pattern.size() && pattern[pat] == '*') {
+            starPat = pat++;
+            starStr = str;
+        } else if (
+                pat < pattern.size()
+                && (pattern[pat] == '?' || pattern[pat] == name[str])) {
+            pat++;
+            str++;
+        } else if (starPat != string_view::npos) {
+            pat = starPat + 1;
+            str = ++starStr;
+        } else {
+            return false;
+        }
+    }
+    while (pat < pattern.size() && pattern[pat] == '*') {
+        pat++;
+    }
+    return pat == pattern.size();
+}
+
+[[nodiscard]] __attribute__((pure)) auto isPattern(string_view const name)
+        -> bool {
+    return name.find_first_of("*?"sv) != string_view::npos;
+}
+
+// Gets the uncompressed contents of an entry. Uncompressed entries are viewed
+// directly in the mapped OBB; compressed entries are inflated into the scratch
+// buffer, which is sized from the file table.
+[[nodiscard]] auto readEntry(
+        XFile_entry const& elem, vector<char>& scratch, string_view& contents)
+        -> bool {
+    if (!elem.compressed) {
+        contents = elem.file();
+        return true;
+    }
+    if (!inflateInto(elem.file(), scratch, elem.fulllength)) {
+        lock_guard<mutex> lock(consoleMutex);
+        cout << "\33[2K\r"sv << flush;
+        cerr << "Could not decompress file "sv << elem.name() << "!"sv << endl;
+        return false;
+    }
+    contents = string_view(scratch.data(), scratch.size());
+    return true;
+}
+
+// Buffers that each worker reuses from one file to the next: scratch holds
+// inflated data, and output holds pretty-printed JSON.
+struct Extract_buffers {
+    vector<char> scratch;
+    vector<char> output;
+};
+
+// Creates the directory of outfile, and writes data to it atomically.
+[[nodiscard]] auto writeOutput(
+        Atomic_writer& writer, path const& outfile, string_view const data)
+        -> bool {
     path const parentdir(outfile.parent_path());
 
-    if (!exists(parentdir) && !create_directories(parentdir)) {
+    boost::system::error_code err;
+    create_directories(parentdir, err);
+    if (!is_directory(parentdir)) {
+        lock_guard<mutex> lock(consoleMutex);
         cout << "\33[2K\r"sv << flush;
         cerr << "Could not create directory "sv << parentdir << " for file "sv
              << outfile << "!"sv << endl;
-        return;
+        return false;
     }
+    if (!writer.write(outfile, data)) {
+        lock_guard<mutex> lock(consoleMutex);
+        cout << "\33[2K\r"sv << flush;
+        cerr << "Could not write file "sv << outfile << "!"sv << endl;
+        return false;
+    }
+    return true;
+}
+
+// Extracts an entry to outfile, and records its hash and disk stamp. JSON
+// files are pretty-printed as they are inflated, one chunk at a time, into the
+// output buffer, and then written out in one go.
+[[nodiscard]] auto extractFile(
+        Atomic_writer& writer, path outfile, XFile_entry const& elem,
+        Extract_buffers& buffers, Manifest_entry& record) -> ErrorCodes {
     if (outfile.extension() == ".minjson"s) {
         outfile.replace_extension(".json"s);
     }
-    ofstream fout(outfile, ios::out | ios::binary);
-    if (!fout.good()) {
-        cout << "\33[2K\r"sv << flush;
-        cerr << "Could not create file "sv << outfile << "!"sv << endl;
-        return;
+    bool const isJson = outfile.extension() == ".json"s
+                        || outfile.extension() == ".inkcontent"s;
+    if (!isJson) {
+        // Nothing to transform, so write it out in one go.
+        string_view contents;
+        if (!readEntry(elem, buffers.scratch, contents)) {
+            return eOBB_CORRUPT;
+        }
+        record.hash = contentHash(contents);
+        if (!writeOutput(writer, outfile, contents)) {
+            return eOUTPUT_NO_ACCESS;
+        }
+        record.stamp = Disk_stamp::of(outfile);
+        return eOK;
+    }
+
+    jsont::Tokenizer reader;
+    Json_printer     printer(ePRETTY, 0U);
+    Json_buffer      sint(buffers.output);
+    buffers.output.clear();
+    buffers.output.reserve(elem.fulllength + elem.fulllength / 2);
+    bool       printing   = true;
+    auto const printChunk = [&](string_view const chunk) {
+        if (printing) {
+            reader.feed(chunk);
+            printing = printer.printAvailable(sint, reader);
+            // The chunk buffer is about to be reused.
+            reader.feed(string_view());
+        }
+    };
+    bool inflated = true;
+    if (elem.compressed) {
+        inflated = inflateChunks(
+                elem.file(), buffers.scratch, elem.fulllength, printChunk);
+    } else {
+        printChunk(elem.file());
     }
-    if (isReference) {
-        cout << "\33[2K\rCreating reference file "sv << outfile << "... "sv
-             << flush;
+    if (inflated && printing) {
+        reader.finish();
+        printer.printAvailable(sint, reader);
     }
-    filtering_ostream fsout;
-    if (compressed) {
-        fsout.push(unzip);
+    if (!inflated) {
+        lock_guard<mutex> lock(consoleMutex);
+        cout << "\33[2K\r"sv << flush;
+        cerr << "Could not decompress file "sv << elem.name() << "!"sv << endl;
+        return eOBB_CORRUPT;
     }
-    if (isReference) {
-        // TODO: Filter should receive OBB wrapper class and read
-        // inkcontent filename = indexed-content/filename
-        fsout.push(json_stitch_filter(inkData));
+    string_view const output(buffers.output.data(), buffers.output.size());
+    record.hash = contentHash(output);
+    if (!writeOutput(writer, outfile, output)) {
+        return eOUTPUT_NO_ACCESS;
     }
-    if (outfile.extension() == ".json"s
-        || outfile.extension() == ".inkcontent"s) {
-        fsout.push(json_filter(ePRETTY));
+    record.stamp = Disk_stamp::of(outfile);
+    return eOK;
+}
+
+// Writes the reference file, with the stitches from the inkcontent file in
+// place in the main JSON file. The stitches are printed with up to jobs
+// threads. Nothing is written if the story files are not valid.
+[[nodiscard]] auto decodeReference(
+        Atomic_writer& writer, path const& outfile, string_view contents,
+        string_view inkData, unsigned const jobs) -> ErrorCodes {
+    cout << "\33[2K\rCreating reference file "sv << outfile << "... "sv
+         << flush;
+    vector<char> output;
+    // TODO: Expander should receive OBB wrapper class and read
+    // inkcontent filename = indexed-content/filename
+    if (!Stitch_expander(inkData, ePRETTY, jobs).expand(contents, output)) {
+        cout << endl;
+        cerr << "Could not expand the story file; not writing "sv << outfile
+             << "!"sv << endl;
+        return eOBB_CORRUPT;
     }
-    fsout.push(fout);
-    fsout << fdata;
-    if (isReference) {
-        cout << "done."sv << flush;
+    if (!writeOutput(
+                writer, outfile, string_view(output.data(), output.size()))) {
+        return eOUTPUT_NO_ACCESS;
     }
+    cout << "done."sv << flush;
+    return eOK;
+}
+
+// Checks the layout of the OBB, and that every compressed file inflates to
+// exactly its size in the file table. Files are inflated in chunks that are
+// thrown away, so memory use does not depend on their sizes.
+[[nodiscard]] auto verifyObb(ObbArchive const& archive, unsigned const jobs)
+        -> bool {
+    size_t numErrors = archive.checkLayout(
+            [](string_view const name, ObbArchive::Error const err) {
+                cerr << "File "sv << name;
+                switch (err) {
+                case ObbArchive::eOUT_OF_BOUNDS:
+                    cerr << " overlaps the OBB header!"sv << endl;
+                    break;
+                case ObbArchive::eMISALIGNED:
+                    cerr << " is not aligned to 16 bytes!"sv << endl;
+                    break;
+                case ObbArchive::eOVERLAPPING:
+                    cerr << " overlaps another file!"sv << endl;
+                    break;
+                default:
+                    cerr << " is out of order in the file table!"sv << endl;
+                    break;
+                }
+            });
+
+    std::atomic<size_t> numCorrupt{0};
+    parallelFor(archive.size(), jobs, [&archive, &numCorrupt]() {
+        return [&archive, &numCorrupt,
+                scratch = vector<char>()](size_t index) mutable {
+            XFile_entry const& elem = archive.files()[index];
+            if (elem.compressed
+                && !inflateChunks(
+                        elem.file(), scratch, elem.fulllength,
+                        [](string_view) {})) {
+                lock_guard<mutex> lock(consoleMutex);
+                cerr << "Could not decompress file "sv << elem.name()
+                     << " to "sv << elem.fulllength << " bytes!"sv << endl;
+                numCorrupt++;
+            }
+        };
+    });
+    numErrors += numCorrupt;
+
+    if (numErrors != 0) {
+        cerr << numErrors << " errors found in "sv << archive.size()
+             << " files."sv << endl;
+        return false;
+    }
+    cout << "All "sv << archive.size() << " files are valid."sv << endl;
+    return true;
 }
 
 extern "C" auto main(int argc, char* argv[]) -> int;
 
 auto main(int argc, char* argv[]) -> int {
     try {
-        if (argc != 3) {
-            cerr << "Usage: "sv << argv[0] << " inputfile outputdir"sv << endl
-                 << endl;
+        string_view const program(argv[0]);
+        unsigned          jobs     = 1;
+        SyncMode          syncMode = eSYNC_NONE;
+        bool              verify   = false;
+        int               argi     = 1;
+        for (; argi < argc; argi++) {
+            string_view const arg(argv[argi]);
+            if (arg == "-j"sv) {
+                if (++argi == argc || !parseJobCount(argv[argi], jobs)) {
+                    cerr << "Option '-j' requires a numeric argument!"sv
+                         << endl
+                         << endl;
+                    usage(cerr, program);
+                    return eINVALID_ARGS;
+                }
+            } else if (arg == "-v"sv) {
+                verify = true;
+            } else if (arg == "-s"sv) {
+                string_view const mode(++argi < argc ? argv[argi] : "");
+                if (mode == "each"sv) {
+                    syncMode = eSYNC_EACH;
+                } else if (mode == "batch"sv) {
+                    syncMode = eSYNC_BATCH;
+                } else {
+                    cerr << "Option '-s' requires 'each' or 'batch'!"sv
+                         << endl
+                         << endl;
+                    usage(cerr, program);
+                    return eINVALID_ARGS;
+                }
+            } else {
+                break;
+            }
+        }
+        if (verify ? argc - argi != 1 : argc - argi < 2) {
+            usage(cerr, program);
             return eWRONG_ARGC;
         }
 
-        path const         obbfile(argv[1]);
-        mapped_file_source obbcontents = readObbFile(obbfile);
+        path const       obbfile(argv[argi]);
+        ObbArchive const archive = readObbFile(obbfile);
+        if (verify) {
+            return verifyObb(archive, jobs) ? eOK : eOBB_CORRUPT;
+        }
 
-        path const outdir(argv[2]);
+        path const outdir(argv[argi + 1]);
         createOutputDir(outdir);
+        Atomic_writer writer(syncMode, outdir);
 
-        string_view const oggview(obbcontents.data(), obbcontents.size());
-        uint32_t const    hlen = Read4(oggview.cbegin() + 8);
-        uint32_t const    htbl = Read4(oggview.cbegin() + 12);
-        if (obbcontents.size() != hlen) {
-            cerr << "Incorrect length in header!"sv << endl << endl;
-            return eOBB_CORRUPT;
+        auto const [mainJson, inkContent] = findStoryFiles(archive);
+        if (mainJson != nullptr) {
+            cout << "\33[2K\rFound main json : "sv << mainJson->name() << endl;
+        }
+        if (inkContent != nullptr) {
+            cout << "\33[2K\rFound inkcontent: "sv << inkContent->name()
+                 << endl;
+        }
+        string referenceName;
+        if (mainJson != nullptr && inkContent != nullptr) {
+            referenceName = mainJson->name().substr(0, "SorceryN"sv.size())
+                            + "-Reference.json"s;
         }
 
-        // TODO: Main json file should be found from Info.plist file:
-        //  main json filename = dict["StoryFilename"sv] + ".json"
-        regex const mainJsonRegex(R"regex(Sorcery\d\.(min)?json)regex"s);
-        // TODO: inkcontent filename should be found from main json:
-        // inkcontent filename = indexed-content/filename
-        regex const inkContentRegex(R"regex(Sorcery\d\.inkcontent)regex"s);
-
-        XFile_entry         mainJson;
-        XFile_entry         inkContent;
-        vector<XFile_entry> entries;
-        entries.reserve((oggview.size() - htbl) / XFile_entry::EntrySize);
-
-        for (const auto* it = oggview.cbegin() + htbl; it != oggview.cend();
-             it += XFile_entry::EntrySize) {
-            entries.emplace_back(it, oggview);
-            // TODO: These should be obtained by name from OBB wrapper when
-            // class is implemented.
-            string_view fname = entries.back().name();
-            if (regex_match(fname.cbegin(), fname.cend(), mainJsonRegex)) {
-                mainJson = entries.back();
-                cout << "\33[2K\rFound main json : "sv << fname << endl;
-            } else if (regex_match(
-                               fname.cbegin(), fname.cend(), inkContentRegex)) {
-                inkContent = entries.back();
-                cout << "\33[2K\rFound inkcontent: "sv << fname << endl;
+        vector<XFile_entry const*> entries;
+        bool const                 extractAll    = argc - argi == 2;
+        bool                       makeReference = !referenceName.empty();
+        unsigned                   numMissing    = 0;
+        if (extractAll) {
+            entries.reserve(archive.size());
+            for (auto const& elem : archive) {
+                entries.push_back(&elem);
+            }
+        } else {
+            // Only the requested entries are read, so only the pages of the
+            // mapped OBB holding their data (and the names, for patterns)
+            // are ever touched.
+            makeReference = false;
+            for (int ii = argi + 2; ii < argc; ii++) {
+                string_view const name(argv[ii]);
+                bool              found = false;
+                if (!referenceName.empty() && globMatch(name, referenceName)) {
+                    makeReference = true;
+                    found         = true;
+                }
+                if (!isPattern(name)) {
+                    if (auto const* elem = archive.find(name)) {
+                        entries.push_back(elem);
+                        found = true;
+                    }
+                } else {
+                    for (auto const& elem : archive) {
+                        if (globMatch(name, elem.name())) {
+                            entries.push_back(&elem);
+                            found = true;
+                        }
+                    }
+                }
+                if (!found) {
+                    cerr << "No file in OBB matches "sv << name << "!"sv
+                         << endl;
+                    numMissing++;
+                }
             }
+            // Restore data order and remove duplicates.
+            sort(entries.begin(), entries.end(), [](auto lhs, auto rhs) {
+                return lhs->file().data() < rhs->file().data();
+            });
+            entries.erase(
+                    unique(entries.begin(), entries.end()), entries.cend());
         }
 
-        // Sort by data order in file, to improve OS prefetching.
-        sort(entries.begin(), entries.end(), [](auto& lhs, auto& rhs) {
-            return lhs.file().data() < rhs.file().data();
-        });
-        {
-            // Save file table for future reference.
-            ofstream      file_table(outdir / "FileTable.ser");
-            text_oarchive oa(file_table);
-            oa << entries;
+        // What is extracted is recorded, so that repackobb can rebuild the
+        // OBB, and tell which files were changed since.
+        Manifest manifest;
+        manifest.obbSize      = archive.data().size();
+        manifest.obbTableHash = contentHash(archive.fileTable());
+        manifest.entries.resize(entries.size());
+        for (size_t ii = 0; ii < entries.size(); ii++) {
+            XFile_entry const& elem   = *entries[ii];
+            Manifest_entry&    record = manifest.entries[ii];
+            record.fname              = elem.name();
+            record.offset             = static_cast<uint32_t>(
+                    elem.file().data() - archive.data().data());
+            record.complength = static_cast<uint32_t>(elem.file().size());
+            record.fulllength = elem.fulllength;
+            record.compressed = elem.compressed;
         }
 
-        zlib_decompressor unzip(zlib::default_window_bits, 1 * 1024 * 1024);
-
-        for (auto& elem : entries) {
-            cout << "\33[2K\rExtracting file "sv << elem.name() << flush;
-
-            path outfile(outdir / elem.name());
-            decodeFile(
-                    unzip, outfile, elem.file(), inkContent.file(),
-                    elem.compressed, false);
+        // Entries are independent of each other, so they can be extracted
+        // concurrently; each worker has its own buffers to decode files in.
+        vector<ErrorCodes> results(entries.size(), eOK);
+        parallelFor(
+                entries.size(), jobs,
+                [&writer, &outdir, &entries, &manifest, &results]() {
+                    return [&writer, &outdir, &entries, &manifest, &results,
+                            buffers = Extract_buffers()](size_t index) mutable {
+                        XFile_entry const& elem = *entries[index];
+                        {
+                            lock_guard<mutex> lock(consoleMutex);
+                            cout << "\33[2K\rExtracting file "sv << elem.name()
+                                 << flush;
+                        }
+
+                        results[index] = extractFile(
+                                writer, outdir / elem.name(), elem, buffers,
+                                manifest.entries[index]);
+                    };
+                });
+        // Files that failed are reported as they fail; the first failure
+        // gives the exit status, once everything else was written.
+        auto const failed = find_if(
+                results.cbegin(), results.cend(),
+                [](ErrorCodes const result) { return result != eOK; });
+
+        ErrorCodes referenceResult = eOK;
+        if (makeReference) {
+            path const outfile(outdir / referenceName);
+            auto       mainView = archive.open(mainJson->name());
+            auto       inkView  = archive.open(inkContent->name());
+            referenceResult     = decodeReference(
+                    writer, outfile, mainView.contents(), inkView.contents(),
+                    jobs);
+            if (referenceResult == eOK) {
+                manifest.reference = Disk_stamp::of(outfile);
+            }
         }
-
-        if (!mainJson.file().empty() && !inkContent.file().empty()) {
-            string const fname = mainJson.name().substr(0, "SorceryN"sv.size())
-                                 + "-Reference.json"s;
-            path const outfile(outdir / fname);
-            decodeFile(
-                    unzip, outfile, mainJson.file(), inkContent.file(),
-                    mainJson.compressed, true);
+        cout << endl;
+        if (extractAll
+            && !writeOutput(
+                    writer, outdir / "FileTable.bin", manifest.serialize())) {
+            return eOUTPUT_NO_ACCESS;
+        }
+        if (!writer.finish()) {
+            cerr << "Could not sync output directory "sv << outdir << "!"sv
+                 << endl;
+            return eOUTPUT_NO_ACCESS;
+        }
+        if (failed != results.cend()) {
+            return *failed;
+        }
+        if (referenceResult != eOK) {
+            return referenceResult;
+        }
+        if (numMissing > 0) {
+            return eENTRY_NOT_FOUND;
         }
+    } catch (ObbArchive::Error) {
         cout << endl;
+        cerr << "Could not decompress story files!"sv << endl;
+        return eOBB_CORRUPT;
     } catch (exception const& except) {
         cerr << except.what() << endl;
     } catch (ErrorCodes err) {